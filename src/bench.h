@@ -0,0 +1,67 @@
+#ifndef NOLIBC
+#include <sys/wait.h>       /* waitpid() */
+#endif
+
+/*
+    Shared helpers for the bench_*.c programs. Include after library.c.
+
+    Output goes through write() rather than printf() so every benchmark
+    builds both against libc and with -DNOLIBC.
+*/
+
+/*
+    Write a string to STDOUT without printf().
+*/
+void print_str(const char *s) {
+    int len = 0;
+    while (s[len] != '\0') { len++; }
+    write(1, s, len);
+}
+
+
+/*
+    Write an unsigned number to STDOUT without printf().
+*/
+void print_num(unsigned long n) {
+    char buf[24];
+    int pos = sizeof(buf);
+    do {
+        buf[--pos] = '0' + (n % 10);
+        n /= 10;
+    } while (n);
+    write(1, buf + pos, sizeof(buf) - pos);
+}
+
+
+/*
+    Monotonic clock in nanoseconds. Under NOLIBC this goes through the vDSO.
+*/
+unsigned long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+
+/*
+    Small deterministic pseudo-random generator (LCG) so runs are repeatable.
+*/
+unsigned int bench_seed = 12345;
+
+unsigned int bench_rand() {
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return (bench_seed >> 16) & 0x7FFF;
+}
+
+
+/*
+    Point the library at an anonymous WIDTHxHEIGHT buffer instead of a real
+    framebuffer, so drawing can be timed without a display or a terminal.
+*/
+void init_headless(int width, int height) {
+    res_width = width;
+    res_height = height;
+    screen_size = (size_t)width * height * sizeof(color_t);
+    display_addr = mmap(0, screen_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    kernels_init();
+}
@@ -0,0 +1,87 @@
+#include "library.c"
+#include "bench.h"
+
+/*
+    Batched line benchmark
+
+    Draws 10k and 100k segments per frame into a headless 640x480 buffer and
+    reports the average time per frame for:
+
+        draw_line       one call per segment (the old way)
+        draw_lines      independent segments in one batch
+        polyline/plot   draw_polyline() on monotonic-x data (column-span path)
+        polyline/walk   draw_polyline() on a random walk (Bresenham path)
+
+        gcc -O2 -o bench_lines bench_lines.c && ./bench_lines
+*/
+
+#define WIDTH  640
+#define HEIGHT 480
+#define FRAMES 20
+#define MAX_SEGMENTS 100000
+
+int plot[2 * (MAX_SEGMENTS + 1)];       // monotonic-x time series
+int walk[2 * (MAX_SEGMENTS + 1)];       // random walk, any direction
+int segs[4 * MAX_SEGMENTS];             // the walk as independent segments
+
+void report(const char *name, int n, unsigned long elapsed) {
+    print_str(name);
+    print_str(" ");
+    print_num(n);
+    print_str(" segments: ");
+    print_num(elapsed / FRAMES / 1000);
+    print_str("us/frame\n");
+}
+
+int main() {
+    int sizes[2] = { 10000, 100000 };
+    int s, n, i, f;
+    unsigned long start;
+
+    init_headless(WIDTH, HEIGHT);
+
+    for (s=0; s<2; s++) {
+        n = sizes[s];
+
+        for (i=0; i<=n; i++) {
+            plot[2*i] = (int)((long)i * (WIDTH-1) / n);         // many samples per column, like a dense plot
+            plot[2*i+1] = 40 + bench_rand() % (HEIGHT-80);
+            walk[2*i] = bench_rand() % WIDTH;
+            walk[2*i+1] = bench_rand() % HEIGHT;
+        }
+        for (i=0; i<n; i++) {
+            segs[4*i] = walk[2*i];      segs[4*i+1] = walk[2*i+1];
+            segs[4*i+2] = walk[2*i+2];  segs[4*i+3] = walk[2*i+3];
+        }
+
+        start = now_ns();
+        for (f=0; f<FRAMES; f++) {
+            for (i=0; i<n; i++) {
+                draw_line(segs[4*i], segs[4*i+1], segs[4*i+2], segs[4*i+3], f);
+            }
+        }
+        report("draw_line     ", n, now_ns() - start);
+
+        start = now_ns();
+        for (f=0; f<FRAMES; f++) { draw_lines(segs, n, f); }
+        report("draw_lines    ", n, now_ns() - start);
+
+        start = now_ns();
+        for (f=0; f<FRAMES; f++) { draw_polyline(walk, n+1, f); }
+        report("polyline/walk ", n, now_ns() - start);
+
+        start = now_ns();
+        for (f=0; f<FRAMES; f++) {
+            for (i=0; i<n; i++) {
+                draw_line(plot[2*i], plot[2*i+1], plot[2*i+2], plot[2*i+3], f);
+            }
+        }
+        report("draw_line/plot", n, now_ns() - start);
+
+        start = now_ns();
+        for (f=0; f<FRAMES; f++) { draw_polyline(plot, n+1, f); }
+        report("polyline/plot ", n, now_ns() - start);
+    }
+
+    return 0;
+}
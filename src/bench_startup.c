@@ -0,0 +1,56 @@
+#include "library.c"
+#include "bench.h"
+
+/*
+    Startup-latency benchmark
+
+    Spawns each program named on the command line RUNS times with fork() +
+    execve() + waitpid() and reports the mean and best round trip in
+    microseconds. Run with no arguments the program exits immediately, so it
+    doubles as its own probe: build it once against libc and once with
+    -DNOLIBC, then time both.
+
+        gcc -O2 -o bench_libc bench_startup.c
+        gcc -DNOLIBC -O2 -static -nostdlib -ffreestanding -fno-builtin \
+            -fno-stack-protector -fno-asynchronous-unwind-tables \
+            -o bench_nolibc bench_startup.c -lgcc
+        ./bench_libc ./bench_libc ./bench_nolibc
+
+    Binaries are spawned with no arguments, so only point this at programs
+    that exit on their own (not driver or square, which wait for input).
+*/
+
+#define RUNS 1000
+
+int main(int argc, char **argv, char **envp) {
+    int i, run, status;
+    unsigned long start, elapsed, total, best;
+
+    for (i=1; i<argc; i++) {
+        char *child_argv[2] = { argv[i], NULL };
+        total = 0;
+        best = ~0UL;
+
+        for (run=0; run<RUNS; run++) {
+            start = now_ns();
+            if (fork() == 0) {
+                execve(argv[i], child_argv, envp);
+                _exit(127);                                 // exec failed
+            }
+            waitpid(-1, &status, 0);
+            elapsed = now_ns() - start;
+
+            total += elapsed;
+            if (elapsed < best) { best = elapsed; }
+        }
+
+        print_str(argv[i]);
+        print_str(": mean ");
+        print_num(total / RUNS / 1000);
+        print_str("us  best ");
+        print_num(best / 1000);
+        print_str("us\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,236 @@
+/*
+    SIMD pixel kernel template
+
+    library.c includes this file once per instruction set, after defining:
+
+        KERNEL_SUFFIX   name suffix for this variant (sse2, avx2, avx512, neon)
+        KERNEL_TARGET   function attribute enabling the instruction set, e.g.
+                        __attribute__((target("avx2"))), or empty for the baseline
+        KERNEL_VBYTES   vector width in bytes (16, 32 or 64)
+
+    The kernels are written with GCC vector extensions rather than intrinsics,
+    so the same source compiles to SSE2, AVX2, AVX-512 or NEON and needs no
+    headers (it builds under NOLIBC too). Each kernel must produce exactly the
+    same pixels as its kernel_*_scalar() reference in library.c; the leftover
+    pixels at the end of a span are done with the scalar formula. Blit rows
+    index the source per lane, so they use int lanes of the full vector width.
+*/
+
+#define KPASTE2(a, b) a##b
+#define KPASTE(a, b) KPASTE2(a, b)
+#define KNAME(name) KPASTE(name, KERNEL_SUFFIX)
+
+#define KLANES16 (KERNEL_VBYTES / 2)        // color_t pixels per vector
+#define KLANES32 (KERNEL_VBYTES / 4)        // 0xRRGGBB pixels per vector
+
+typedef unsigned short KNAME(v16_) __attribute__((vector_size(KERNEL_VBYTES), aligned(2), may_alias));
+typedef unsigned int KNAME(v32_) __attribute__((vector_size(KERNEL_VBYTES), aligned(4), may_alias));
+typedef unsigned short KNAME(vh16_) __attribute__((vector_size(KERNEL_VBYTES / 2), aligned(2), may_alias));
+typedef unsigned short KNAME(g16_) __attribute__((vector_size(16), aligned(2), may_alias));
+typedef int KNAME(vi32_) __attribute__((vector_size(KERNEL_VBYTES)));
+
+
+KERNEL_TARGET static void KNAME(kernel_fill_)(color_t *dst, color_t c, int n) {
+    KNAME(v16_) v = (KNAME(v16_)){0} + c;                       // broadcast
+    for (; n >= KLANES16; n -= KLANES16, dst += KLANES16) {
+        *(KNAME(v16_) *)dst = v;
+    }
+    while (n-- > 0) { *dst++ = c; }
+}
+
+
+KERNEL_TARGET static void KNAME(kernel_copy_)(color_t *dst, const color_t *src, int n) {
+    for (; n >= KLANES16; n -= KLANES16, dst += KLANES16, src += KLANES16) {
+        *(KNAME(v16_) *)dst = *(const KNAME(v16_) *)src;
+    }
+    while (n-- > 0) { *dst++ = *src++; }
+}
+
+
+/*
+    Every channel product fits in 16 bits (63 * 32 = 2016), so the blend
+    never has to widen.
+*/
+KERNEL_TARGET static void KNAME(kernel_blend_)(color_t *dst, const color_t *src, int alpha, int n) {
+    KNAME(v16_) s, d, r, g, b;
+    unsigned short a = alpha, ia = 32 - alpha;
+
+    for (; n >= KLANES16; n -= KLANES16, dst += KLANES16, src += KLANES16) {
+        s = *(const KNAME(v16_) *)src;
+        d = *(KNAME(v16_) *)dst;
+        r = (((s >> 11) * a + (d >> 11) * ia) >> 5) << 11;
+        g = (((((s >> 5) & 63) * a + ((d >> 5) & 63) * ia) >> 5) & 63) << 5;
+        b = ((s & 31) * a + (d & 31) * ia) >> 5;
+        *(KNAME(v16_) *)dst = r | g | b;
+    }
+    kernel_blend_scalar(dst, src, alpha, n);
+}
+
+
+/*
+    One 8-pixel group per byte of glyph bits; glyph rows are at most a few
+    groups wide, so every variant uses 128-bit groups (VEX/EVEX encoded
+    under AVX2/AVX-512) with the precomputed glyph_masks[] table.
+*/
+KERNEL_TARGET static void KNAME(kernel_glyph_)(color_t *dst, unsigned int bits, int width, color_t c) {
+    KNAME(g16_) v = (KNAME(g16_)){0} + c, m, d;
+    for (; width >= 8; width -= 8, dst += 8, bits >>= 8) {
+        if (!(bits & 0xFF)) { continue; }
+        m = *(const KNAME(g16_) *)glyph_masks[bits & 0xFF];
+        d = *(KNAME(g16_) *)dst;
+        *(KNAME(g16_) *)dst = (d & ~m) | (v & m);
+    }
+    kernel_glyph_scalar(dst, bits, width, c);
+}
+
+
+KERNEL_TARGET static void KNAME(kernel_convert_)(color_t *dst, const unsigned int *src, int n) {
+    KNAME(v32_) p, out;
+    for (; n >= KLANES32; n -= KLANES32, dst += KLANES32, src += KLANES32) {
+        p = *(const KNAME(v32_) *)src;
+        out = ((p >> 8) & 0xF800) | ((p >> 5) & 0x07E0) | ((p >> 3) & 0x001F);
+        *(KNAME(vh16_) *)dst = __builtin_convertvector(out, KNAME(vh16_));
+    }
+    kernel_convert_scalar(dst, src, n);
+}
+
+
+/*
+    Nearest-neighbour blit row: the 16.16 sample positions and source
+    offsets of a whole vector of pixels are computed at once; only the
+    loads themselves are one per lane (there are no 16-bit gathers).
+*/
+KERNEL_TARGET static void KNAME(kernel_nearest_)(color_t *dst, const bitmap_t *src, fixed_t u, fixed_t v, fixed_t du, fixed_t dv, int n) {
+    const color_t *pixels = src->pixels;
+    KNAME(vi32_) lane, vu, vv;
+    int at[KLANES32] __attribute__((aligned(KERNEL_VBYTES)));
+    int i;
+
+    for (i=0; i<KLANES32; i++) { lane[i] = i; }
+    vu = u + lane * du;
+    vv = v + lane * dv;
+    for (; n >= KLANES32; n -= KLANES32, dst += KLANES32) {
+        *(KNAME(vi32_) *)at = (vv >> 16) * src->stride + (vu >> 16);
+        for (i=0; i<KLANES32; i++) { dst[i] = pixels[at[i]]; }
+        vu += KLANES32 * du;
+        vv += KLANES32 * dv;
+    }
+    kernel_nearest_scalar(dst, src, vu[0], vv[0], du, dv, n);
+}
+
+
+/*
+    Bilinear blit row: positions, edge clamps, weights and the spread-RGB565
+    blend of kernel_bilinear_scalar() done a vector of pixels at a time,
+    with the four neighbours loaded per lane.
+*/
+KERNEL_TARGET static void KNAME(kernel_bilinear_)(color_t *dst, const bitmap_t *src, fixed_t u, fixed_t v, fixed_t du, fixed_t dv, int n) {
+    const color_t *pixels = src->pixels;
+    int stride = src->stride, w1 = src->width - 1, h1 = src->height - 1, i;
+    KNAME(vi32_) lane, vu, vv, x0, y0, x1, y1, mask, at[4];
+    KNAME(v32_) p00, p01, p10, p11, fx, fy, top, bottom;
+    unsigned int p[4][KLANES32] __attribute__((aligned(KERNEL_VBYTES)));
+
+    for (i=0; i<KLANES32; i++) { lane[i] = i; }
+    vu = u + lane * du - 0x8000;                                // sample centres sit at +0.5
+    vv = v + lane * dv - 0x8000;
+    for (; n >= KLANES32; n -= KLANES32, dst += KLANES32) {
+        x0 = vu >> 16;
+        y0 = vv >> 16;
+        fx = (KNAME(v32_))((vu >> 11) & 31);
+        fy = (KNAME(v32_))((vv >> 11) & 31);
+        mask = x0 >> 31;                                        // x0 < 0: clamp to column 0, no blend
+        x0 &= ~mask;
+        fx &= ~(KNAME(v32_))mask;
+        mask = y0 >> 31;
+        y0 &= ~mask;
+        fy &= ~(KNAME(v32_))mask;
+        mask = x0 < w1;                                         // right and bottom neighbours, clamped
+        x1 = ((x0 + 1) & mask) | (w1 & ~mask);
+        mask = y0 < h1;
+        y1 = ((y0 + 1) & mask) | (h1 & ~mask);
+
+        at[0] = y0 * stride + x0;                               // spill the offsets, then load per lane
+        at[1] = y0 * stride + x1;
+        at[2] = y1 * stride + x0;
+        at[3] = y1 * stride + x1;
+        for (i=0; i<KLANES32; i++) {
+            p[0][i] = pixels[at[0][i]];
+            p[1][i] = pixels[at[1][i]];
+            p[2][i] = pixels[at[2][i]];
+            p[3][i] = pixels[at[3][i]];
+        }
+        p00 = *(KNAME(v32_) *)p[0];
+        p01 = *(KNAME(v32_) *)p[1];
+        p10 = *(KNAME(v32_) *)p[2];
+        p11 = *(KNAME(v32_) *)p[3];
+        p00 = ((p00 << 16) | p00) & 0x07E0F81F;                 // RGB565_SPREAD
+        p01 = ((p01 << 16) | p01) & 0x07E0F81F;
+        p10 = ((p10 << 16) | p10) & 0x07E0F81F;
+        p11 = ((p11 << 16) | p11) & 0x07E0F81F;
+        top = ((p00 * (32 - fx) + p01 * fx) >> 5) & 0x07E0F81F; // RGB565_LERP
+        bottom = ((p10 * (32 - fx) + p11 * fx) >> 5) & 0x07E0F81F;
+        top = ((top * (32 - fy) + bottom * fy) >> 5) & 0x07E0F81F;
+        *(KNAME(vh16_) *)dst = __builtin_convertvector((top >> 16) | top, KNAME(vh16_));   // RGB565_PACK
+
+        vu += KLANES32 * du;
+        vv += KLANES32 * dv;
+    }
+    kernel_bilinear_scalar(dst, src, vu[0] + 0x8000, vv[0] + 0x8000, du, dv, n);
+}
+
+
+/*
+    Gradient run: the per-channel lerp, dither and clamp of gradient_color()
+    across a vector of T values. KLANES32 is a multiple of 4, so one vector
+    of dither thresholds serves the whole row.
+*/
+KERNEL_TARGET static void KNAME(kernel_gradient_)(color_t *dst, const fill_t *f, const int *t, int x, int y, int n) {
+    int fr = (f->from >> 16) & 0xFF, fg = (f->from >> 8) & 0xFF, fb = f->from & 0xFF;
+    int dr = (int)((f->to >> 16) & 0xFF) - fr, dg = (int)((f->to >> 8) & 0xFF) - fg, db = (int)(f->to & 0xFF) - fb;
+    KNAME(vi32_) d, tc, r, g, b;
+    int i;
+
+    for (i=0; i<KLANES32; i++) { d[i] = dither_4x4[y & 3][(x + i) & 3]; }
+    for (; n >= KLANES32; n -= KLANES32, dst += KLANES32, t += KLANES32, x += KLANES32) {
+        tc = (KNAME(vi32_))*(const KNAME(v32_) *)t >> 8;
+        tc &= ~(tc >> 31);                                      // clamp to 0..256
+        tc = (tc & (tc <= 256)) | (256 & (tc > 256));
+
+        r = fr + ((dr * tc) >> 8);
+        g = fg + ((dg * tc) >> 8);
+        b = fb + ((db * tc) >> 8);
+        r = (r + (d >> 1)) >> 3;                                // 8 -> 5/6/5 bits with the dither threshold
+        g = (g + (d >> 2)) >> 2;
+        b = (b + (d >> 1)) >> 3;
+        r = (r & (r <= 31)) | (31 & (r > 31));
+        g = (g & (g <= 63)) | (63 & (g > 63));
+        b = (b & (b <= 31)) | (31 & (b > 31));
+
+        *(KNAME(vh16_) *)dst = __builtin_convertvector((KNAME(v32_))((r << 11) | (g << 5) | b), KNAME(vh16_));
+    }
+    kernel_gradient_scalar(dst, f, t, x, y, n);
+}
+
+
+/*
+    Pattern run: the pattern repeats every 8 pixels and KLANES16 is a
+    multiple of 8, so one vector of colors is built and stored repeatedly.
+*/
+KERNEL_TARGET static void KNAME(kernel_pattern_)(color_t *dst, unsigned int bits, color_t set, color_t clear, int n) {
+    KNAME(v16_) v;
+    int i;
+
+    for (i=0; i<KLANES16; i++) { v[i] = ((bits >> (i & 7)) & 1) ? set : clear; }
+    for (; n >= KLANES16; n -= KLANES16, dst += KLANES16) {
+        *(KNAME(v16_) *)dst = v;
+    }
+    kernel_pattern_scalar(dst, bits, set, clear, n);
+}
+
+
+#undef KLANES16
+#undef KLANES32
+#undef KNAME
+#undef KPASTE
+#undef KPASTE2
@@ -1,4 +1,12 @@
+#ifdef NOLIBC
+#include "nolibc.h"         /* raw syscalls, _start, vDSO clock_gettime() */
+#else
+#define _GNU_SOURCE         /* pthread_setaffinity_np() CPU_SET() */
 #include <fcntl.h>          /* open() */
+#include <pthread.h>        /* pthread_create() */
+#include <sched.h>          /* cpu_set_t */
+#include <string.h>         /* memset() */
+#include <sys/auxv.h>       /* getauxval() */
 #include <termios.h>        /* TCGETS TCSETS */
 #include <time.h>           /* nanosleep() */
 #include <unistd.h>         /* read() write() */
@@ -7,6 +15,7 @@
 #include <sys/mman.h>       /* PROT_READ PROT_WRITE */
 #include <sys/stat.h>       /* open() */
 #include <sys/types.h>      /* open() select() */
+#endif
 #include "iso_font.h"       /* font file */
 
 /*
@@ -31,12 +40,197 @@ typedef unsigned short color_t;     // store RGB color
     [15-14-13-12-11]  [10-09-08-07-06-05]  [04-03-02-01-00]
 */
 
+typedef int fixed_t;                // 16.16 fixed-point number
+#define FIXED(n) ((fixed_t)((n) * 65536))
+
+typedef struct {                    // an in-memory RGB565 image
+    int width, height;              // size in pixels
+    int stride;                     // pixels from one row to the next
+    const color_t *pixels;
+} bitmap_t;
+
+#define BLIT_NEAREST  0             // draw_bitmap_affine() filters
+#define BLIT_BILINEAR 1
+
+typedef struct {                    // how fill_rect() / fill_circle() / fill_polygon() color pixels
+    int style;                      // FILL_SOLID, FILL_LINEAR, FILL_RADIAL, FILL_PATTERN or FILL_BITMAP
+    color_t color;                  // SOLID color, PATTERN set bits
+    color_t background;             // PATTERN clear bits
+    unsigned int from, to;          // gradient end colors as 0xRRGGBB
+    int x0, y0, x1, y1;             // LINEAR: (x0,y0) -> (x1,y1); RADIAL: centre (x0,y0), radius x1
+    unsigned char pattern[8];       // PATTERN: one byte per row, bit N = column N
+    const bitmap_t *tile;           // BITMAP: image repeated across the display
+} fill_t;
+
+#define FILL_SOLID   0
+#define FILL_LINEAR  1
+#define FILL_RADIAL  2
+#define FILL_PATTERN 3
+#define FILL_BITMAP  4
+
+#define MAX_SPRITES 8               // sprite_create() slots
+#define SPRITE_MAX_PIXELS (64 * 64) // largest image (width * height) a sprite can save under
+
+typedef struct {                    // a software sprite and its save-under buffers
+    const bitmap_t *image;              // NULL when the slot is free
+    color_t key;                        // transparent color in the image
+    int visible;
+    int x, y;                           // upper-left corner on the display (may be off screen)
+    color_t *save;                      // pixels under the sprite, image-sized, row-major
+    color_t *spare;                     // second buffer, swapped with save on every move
+    color_t buffers[2][SPRITE_MAX_PIXELS];
+} sprite_t;
+
+typedef unsigned char color_index_t;        // palette index in 8-bit indexed mode
+
+#define PALETTE_SIZE 256
+#define PALETTE_MAX_ANIMS 16
+
+#define PALETTE_ANIM_NONE  0
+#define PALETTE_ANIM_CYCLE 1
+#define PALETTE_ANIM_BLINK 2
+
+typedef struct {                    // a palette_cycle() or palette_blink() animation
+    int kind;                       // PALETTE_ANIM_NONE when the slot is free
+    int first, count;               // palette entries affected
+    int period, timer;              // frames between steps, frames since the last step
+    int phase;                      // BLINK: 0 shows color a, 1 shows color b
+    unsigned int a, b;              // BLINK colors as 0xRRGGBB
+} palette_anim_t;
+
+typedef struct {                    // one set of pixel kernels (see kernels_init())
+    const char *name;
+    void (*fill)(color_t *dst, color_t c, int n);
+    void (*copy)(color_t *dst, const color_t *src, int n);
+    void (*blend)(color_t *dst, const color_t *src, int alpha, int n);
+    void (*glyph)(color_t *dst, unsigned int bits, int width, color_t c);
+    void (*convert)(color_t *dst, const unsigned int *src, int n);
+    void (*nearest)(color_t *dst, const bitmap_t *src, fixed_t u, fixed_t v, fixed_t du, fixed_t dv, int n);
+    void (*bilinear)(color_t *dst, const bitmap_t *src, fixed_t u, fixed_t v, fixed_t du, fixed_t dv, int n);
+    void (*gradient)(color_t *dst, const fill_t *f, const int *t, int x, int y, int n);
+    void (*pattern)(color_t *dst, unsigned int bits, color_t set, color_t clear, int n);
+} kernels_t;
+
+#define FONT_MAX_MAP 1024           // Unicode mappings above U+00FF kept per font
+#define FONT_NO_GLYPH 0xFFFF        // latin1[] entry with no glyph
+#define FONT_MAX_CELL 256           // widest / tallest glyph font_load() accepts
+#define FONT_MAX_SCALE 16           // largest font_scale()
+
+typedef struct {                    // code point -> glyph, for code points above 255
+    int cp;
+    int glyph;
+} font_map_t;
+
+typedef struct {                    // a PSF1/PSF2 console font (see font_load())
+    const unsigned char *map;       // the whole file, mmap()ed read-only
+    size_t map_size;
+    const unsigned char *glyphs;    // first glyph bitmap, inside map
+    int count;                      // number of glyphs
+    int width, height;              // glyph cell in pixels, before scaling
+    int row_bytes, glyph_bytes;     // size of one bitmap row and one glyph in the file
+    int scale;                      // integer scale set by font_scale()
+    int cache_words;                // 32-bit words per scaled glyph row
+    unsigned int *cache;            // scaled glyph rows of every glyph, built by font_scale()
+    size_t cache_size;              // bytes mapped for cache
+    unsigned short latin1[256];     // code points 0..255 -> glyph
+    int map_count;                  // entries used in unicode[]
+    font_map_t unicode[FONT_MAX_MAP];   // higher code points, sorted by cp
+} font_t;
+
+typedef struct {                    // one line of text from font_layout()
+    int start, length;              // bytes of the text
+    int width;                      // pixels
+} text_line_t;
+
+#define MAX_DISPLAYS 8              // display_open() slots
+
+typedef struct {                    // one open framebuffer
+    int fd;                         // -1 when the slot is free
+    int fake;                       // file-backed stand-in, not a real device
+    size_t size;                    // bytes mapped
+    color_t *addr;                  // start of the mapping
+    struct fb_var_screeninfo var;   // resolution and bit depth
+    struct fb_fix_screeninfo fix;   // line length
+    struct fb_var_screeninfo saved_var;     // mode at open, put back by display_close()
+    int mode_changed;                       // display_open_bpp() switched the depth
+    int cmap_saved;                         // saved_red/green/blue hold the palette at open
+    unsigned short saved_red[PALETTE_SIZE], saved_green[PALETTE_SIZE], saved_blue[PALETTE_SIZE];
+#ifndef NOLIBC
+    pthread_t thread;               // render thread from display_start()
+    int cpu;                        // CPU it is pinned to, -1 for any
+    void (*render)(int id, void *arg);
+    void *arg;
+#endif
+} display_t;
+
+#ifdef NOLIBC
+#define DISPLAY_LOCAL                       // no TLS without libc: one drawing thread
+#else
+#define DISPLAY_LOCAL __thread              // each render thread draws to its own display
+#endif
+
+#define TRACE_VERSION 2             // trace file format (see trace_open())
+#define TRACE_INIT      1           // trace record opcodes
+#define TRACE_PIXEL     2
+#define TRACE_LINE      3
+#define TRACE_CHAR      4
+#define TRACE_TEXT      5
+#define TRACE_POLYLINE  6
+#define TRACE_LINES     7
+#define TRACE_FILL_RECT 8
+#define TRACE_FILL_CIRCLE 9
+#define TRACE_FILL_POLYGON 10
+#define TRACE_KEY       11
+#define TRACE_FRAME     12
+#define TRACE_UNTRACED  13          // drawing replay cannot reproduce, one of:
+#define UNTRACED_BITMAP 1           //   draw_bitmap*() (pixels are not recorded)
+#define UNTRACED_SPRITE 2           //   sprite_show() / sprite_move() / sprite_hide()
+#define UNTRACED_INDEXED 3          //   8-bit indexed mode drawing
+#define UNTRACED_FONT   4           //   font_draw_*() (the font is not recorded)
+
+#ifndef TRACE_FILE
+#define TRACE_FILE "graphics.trace" // where init_graphics() starts tracing under -DTRACE
+#endif
+
+#ifdef TRACE                        // record a public call, unless made from inside another one
+#define TRACE_CALL(op, n, ...)          do { if (!trace_mute) { trace_call((op), (n), __VA_ARGS__); } } while (0)
+#define TRACE_POINTS(op, p, n, per, c)  do { if (!trace_mute) { trace_points((op), (p), (n), (per), (c)); } } while (0)
+#define TRACE_TEXT_CALL(x, y, t, c)     do { if (!trace_mute) { trace_text((x), (y), (t), (c)); } } while (0)
+#define TRACE_FILL_CALL(f)              do { if (!trace_mute) { trace_fill(f); } } while (0)
+#define TRACE_MUTE(d)                   (trace_mute += (d))
+#else
+#define TRACE_CALL(op, n, ...)
+#define TRACE_POINTS(op, p, n, per, c)
+#define TRACE_TEXT_CALL(x, y, t, c)
+#define TRACE_FILL_CALL(f)
+#define TRACE_MUTE(d)
+#endif
+
 int fd_display;                             // reference to display
-int res_height, res_width;                  // store display-height and width calculation
+DISPLAY_LOCAL int res_height, res_width;    // store display-height and width calculation
 size_t screen_size;                         // number of bytes of entire display
-color_t *display_addr;                      // starting address of display
+DISPLAY_LOCAL color_t *display_addr;        // starting address of display
 struct fb_var_screeninfo display_res;       // resolution for the mapped display
 struct fb_fix_screeninfo display_depth;     // bit depth for the mapped display
+sprite_t sprites[MAX_SPRITES];              // software sprite slots (see sprite_create())
+DISPLAY_LOCAL unsigned char *index_addr;    // display as palette indices (8-bit indexed mode)
+DISPLAY_LOCAL int index_stride;             // bytes from one display row to the next
+display_t displays[MAX_DISPLAYS];           // every open display (see display_open())
+int displays_ready;                         // displays[] slots initialised to free
+kernels_t kernels;                          // active pixel kernels (see kernels_init())
+#ifdef TRACE
+int trace_mute;                             // > 0 while inside a traced call
+#endif
+
+unsigned short palette_red[PALETTE_SIZE];   // shadow of the hardware palette (16 bits per channel)
+unsigned short palette_green[PALETTE_SIZE];
+unsigned short palette_blue[PALETTE_SIZE];
+int palette_dirty_lo, palette_dirty_hi;     // entries changed since the last palette_commit()
+int palette_lookup_stale;                   // palette changed since palette_lookup[] was built
+color_index_t palette_lookup[4096];         // 0xRGB (4 bits each) -> nearest palette index
+palette_anim_t palette_anims[PALETTE_MAX_ANIMS];
+unsigned char palette_animated[PALETTE_SIZE];   // running animations using each entry
+
 
 char getkey();
 int abs(int value);
@@ -44,12 +238,104 @@ int modulo(int x, int N);
 void clear_screen();
 void draw_pixel(int x, int y, color_t color);
 void draw_line(int x1, int y1, int x2, int y2, color_t c);
+void draw_polyline(const int *points, int count, color_t c);
+void draw_lines(const int *segments, int count, color_t c);
+void draw_segment(int x1, int y1, int x2, int y2, color_t c, int flags);
+void segment_clip_axis(int p, int s, long long num, long long bias, long long den, int limit, long long *k0, long long *k1);
 void draw_text(int x, int y, const char *text, color_t c);
 void draw_char(int x, int y, const int c, color_t color);
+void draw_bitmap_affine(const bitmap_t *src, const fixed_t m[6], int filter);
+void draw_bitmap_upscale(const bitmap_t *src, int k, int tx, int ty);
+void blit_span_limit(fixed_t p0, fixed_t dp, int limit, int *lo, int *hi);
+int fixed_fits(double v);
+void kernel_nearest_scalar(color_t *dst, const bitmap_t *src, fixed_t u, fixed_t v, fixed_t du, fixed_t dv, int n);
+void kernel_bilinear_scalar(color_t *dst, const bitmap_t *src, fixed_t u, fixed_t v, fixed_t du, fixed_t dv, int n);
+long long floor_div_ll(long long a, long long b);
+void fill_span(int x, int y, int n, const fill_t *f);
+void fill_hspan(int x1, int x2, int y, const fill_t *f);
+void fill_rect(int x, int y, int w, int h, const fill_t *f);
+void fill_circle(int cx, int cy, int r, const fill_t *f);
+void fill_polygon(const int *points, int count, const fill_t *f);
+unsigned int isqrt(unsigned long long n);
+int sprite_create(const bitmap_t *image, color_t key);
+void sprite_destroy(int id);
+void sprite_show(int id, int x, int y);
+void sprite_hide(int id);
+void sprite_move(int id, int x, int y);
+void sprite_composite(sprite_t *s, int had_old, int ox, int oy, int draw_new, int nx, int ny);
+void sprite_rows(sprite_t *s, int had_old, int ox, int oy, int draw_new, int nx, int ny, int y0, int y1);
+void kernel_fill_scalar(color_t *dst, color_t c, int n);
+void kernel_copy_scalar(color_t *dst, const color_t *src, int n);
+void kernel_blend_scalar(color_t *dst, const color_t *src, int alpha, int n);
+void kernel_glyph_scalar(color_t *dst, unsigned int bits, int width, color_t c);
+void kernel_convert_scalar(color_t *dst, const unsigned int *src, int n);
+void kernel_gradient_scalar(color_t *dst, const fill_t *f, const int *t, int x, int y, int n);
+void kernel_pattern_scalar(color_t *dst, unsigned int bits, color_t set, color_t clear, int n);
+int kernel_supported(const char *name);
+int kernel_name_is(const char *a, const char *b);
+void kernel_glyph_masks();
+int kernels_select(const char *name);
+void kernels_init();
+void draw_bitmap(int x, int y, const bitmap_t *src);
+void draw_bitmap_alpha(int x, int y, const bitmap_t *src, int alpha);
+void convert_rgb888(color_t *dst, const unsigned int *src, int n);
+unsigned int read_u32le(const unsigned char *p);
+int utf8_next(const char **s);
+int utf8_next_n(const char **s, const char *end);
+void font_map_add(font_t *f, int cp, int glyph);
+void font_read_unicode(font_t *f, const unsigned char *table, int psf2);
+int font_load(font_t *f, const char *path);
+void font_close(font_t *f);
+int font_scale(font_t *f, int scale);
+int font_glyph(const font_t *f, int cp);
+const unsigned int *font_glyph_rows(const font_t *f, int glyph);
+void font_draw_glyph(const font_t *f, int x, int y, int glyph, color_t c);
+int font_layout(const font_t *f, const char *text, int max_width, text_line_t *lines, int max_lines);
+void font_measure(const font_t *f, const char *text, int *width, int *height);
+void font_draw_lines(const font_t *f, int x, int y, const char *text, const text_line_t *lines, int count, color_t c);
+void font_draw_text(const font_t *f, int x, int y, const char *text, color_t c);
 void init_graphics();
+int init_graphics_bpp(int bpp);
+int init_graphics_indexed();
+void draw_pixel_index(int x, int y, color_index_t index);
+void fill_rect_index(int x, int y, int w, int h, color_index_t index);
+void palette_load();
+void palette_set(int index, unsigned int rgb);
+unsigned int palette_get(int index);
+void palette_commit();
+color_index_t palette_nearest(unsigned int rgb);
+int palette_add_anim(int kind, int first, int count, int period, unsigned int a, unsigned int b);
+int palette_cycle(int first, int count, int period);
+int palette_blink(int index, unsigned int a, unsigned int b, int period);
+void palette_stop(int id);
+void palette_frame();
 void exit_graphics();
+int display_slot();
+int display_open_bpp(const char *path, int bpp);
+int display_open(const char *path);
+int display_open_fake(const char *path, int width, int height);
+int display_enumerate();
+void display_select(int id);
+void display_close(int id);
+#ifndef NOLIBC
+void *display_thread(void *arg);
+int display_start(int id, int cpu, void (*render)(int id, void *arg), void *arg);
+void display_join(int id);
+#endif
 void set_terminal_settings(int on);
 void sleep_ms(long ms);
+void trace_frame();
+#ifdef TRACE
+int trace_open(const char *path);
+void trace_flush();
+void trace_close();
+void trace_byte(int b);
+void trace_int(long v);
+void trace_call(int op, int n, ...);
+void trace_points(int op, const int *coords, int count, int per, color_t c);
+void trace_text(int x, int y, const char *text, color_t c);
+void trace_fill(const fill_t *f);
+#endif
 
 #define DISPLAY_DEVICE "/dev/fb0"   // the name of the display/framebuffer to manipulate
 
@@ -72,34 +358,555 @@ void sleep_ms(long ms);
     void *mmap(void *ADDR, size_t lengthint PROT, int FLAGS, int fd, off_t OFFSET);
 */
 void init_graphics() {
-    clear_screen();                                                         // clear the terminal
-    fd_display = open(DISPLAY_DEVICE, O_RDWR);                              // open display (framebuffer)
+    init_graphics_bpp(0);                                                   // keep the display's current depth
+}
+
+
+/*
+    init_graphics() with an optional bit depth to switch the display to
+    (FBIOPUT_VSCREENINFO) before it is mapped; 0 leaves it as it is.
+    Returns 0, or -1 if the display cannot be opened.
+*/
+int init_graphics_bpp(int bpp) {
+    int id;
 
-    ioctl(fd_display, FBIOGET_VSCREENINFO, &display_res);                   // get display resolution
-    ioctl(fd_display, FBIOGET_FSCREENINFO, &display_depth);                 // get display bit-depth
+    clear_screen();                                                         // clear the terminal
+    id = display_open_bpp(DISPLAY_DEVICE, bpp);                             // open and map display (framebuffer)
+    if (id < 0) { return -1; }
+    display_select(id);                                                     // draw to it from this thread
 
-    res_height = display_res.yres_virtual;                                  // display-height resolution
-    res_width = (display_depth.line_length/(sizeof *display_addr));         // display-width resolution
-    screen_size = display_res.yres_virtual * display_depth.line_length;     // length x width (w/ bit depth)
+    fd_display = displays[id].fd;
+    display_res = displays[id].var;                                         // display resolution
+    display_depth = displays[id].fix;                                       // display bit-depth
+    screen_size = displays[id].size;                                        // length x width (w/ bit depth)
 
-    // map the opened display for manipulation, starting at offset 0 (map everything)
-    display_addr = mmap(0, screen_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_display, 0);
+#ifdef TRACE
+    trace_open(TRACE_FILE);                                                 // record this session
+    trace_call(TRACE_INIT, 2, (long)res_width, (long)res_height);
+#endif
 
     set_terminal_settings(0);    // turn ICANON and ECHO terminal flags OFF
+    return 0;
 }
 
 
 /*
-    Clear the screen, reset terminal settings, unmap the display,
-    and then close the display file descriptor.
+    Clear the screen, reset terminal settings, unmap the displays,
+    and then close the display file descriptors.
 
     int munmap(void *ADDR, size_t LENGTH);
 */
 void exit_graphics() {
+    int id;
     clear_screen();                         // clear the screen
     set_terminal_settings(1);               // turn ICANON and ECHO terminal flags back on
-    munmap(display_addr, screen_size);      // remove all mappings that contain pages in given address space
-    close(fd_display);                      // close the display
+    for (id=0; id<MAX_DISPLAYS; id++) {
+        display_close(id);                  // unmap and close every display still open
+    }
+#ifdef TRACE
+    trace_close();                          // write out the rest of the trace
+#endif
+}
+
+
+/*
+    Multiple displays. Every framebuffer opened with display_open() (or
+    found by display_enumerate()) gets a slot in displays[] with its own
+    file descriptor, mapping, geometry and bit depth.
+
+    Drawing functions always target the CURRENT display: display_addr,
+    res_width, res_height, index_addr and index_stride. Those are
+    thread-local, so display_select() in one thread does not move another
+    thread's drawing. display_start() runs a render function on its own
+    thread, pinned to a CPU, with its display already selected. Anything
+    read-only (iso_font[], bitmap_t pixels, fill_t styles) can be shared by
+    all render threads as is; sprites and the palette shadow are NOT per
+    display and belong to one thread.
+
+    Render threads need libc (pthreads and TLS); under NOLIBC displays can
+    still be opened and selected from the single main thread.
+*/
+
+/*
+    Find a free slot in displays[], or -1. The first call also picks the
+    pixel kernels for this CPU, so every way of opening a display gets
+    them before any drawing (or render thread) starts.
+*/
+int display_slot() {
+    int id;
+    if (!displays_ready) {
+        for (id=0; id<MAX_DISPLAYS; id++) { displays[id].fd = -1; }
+        displays_ready = 1;
+        kernels_init();
+    }
+    for (id=0; id<MAX_DISPLAYS; id++) {
+        if (displays[id].fd < 0) { return id; }
+    }
+    return -1;
+}
+
+
+/*
+    Open and map the framebuffer device at PATH, optionally switching it
+    to BPP bits per pixel first (0 keeps its current depth). The mode and
+    palette at open are saved and put back by display_close(), so the
+    console is left as it was found. Returns the display id, or -1 if it
+    cannot be opened, queried or mapped (the slot is then free again). The
+    depth actually granted is in displays[id].var.
+*/
+int display_open_bpp(const char *path, int bpp) {
+    int id = display_slot();
+    struct fb_cmap cmap;
+    display_t *d;
+
+    if (id < 0) { return -1; }
+    d = &displays[id];
+    d->fake = 0;
+    d->mode_changed = 0;
+    d->cmap_saved = 0;
+    d->addr = NULL;
+    d->fd = open(path, O_RDWR);
+    if (d->fd < 0) { d->fd = -1; return -1; }
+
+    if (ioctl(d->fd, FBIOGET_VSCREENINFO, &d->var) < 0) {      // get display resolution
+        display_close(id);                                      // not a framebuffer
+        return -1;
+    }
+    d->saved_var = d->var;
+    cmap.start = 0;                                             // and the palette (fails harmlessly on
+    cmap.len = PALETTE_SIZE;                                    // displays without one)
+    cmap.red = d->saved_red;
+    cmap.green = d->saved_green;
+    cmap.blue = d->saved_blue;
+    cmap.transp = NULL;
+    d->cmap_saved = (ioctl(d->fd, FBIOGETCMAP, &cmap) == 0);
+
+    if (bpp && d->var.bits_per_pixel != (unsigned)bpp) {
+        d->var.bits_per_pixel = bpp;                            // ask for the new depth...
+        ioctl(d->fd, FBIOPUT_VSCREENINFO, &d->var);
+        ioctl(d->fd, FBIOGET_VSCREENINFO, &d->var);             // ...and see what we got
+        d->mode_changed = 1;
+    }
+    if (ioctl(d->fd, FBIOGET_FSCREENINFO, &d->fix) < 0) {      // get display bit-depth
+        display_close(id);                                      // puts the old mode back
+        return -1;
+    }
+
+    d->size = d->var.yres_virtual * d->fix.line_length;         // length x width (w/ bit depth)
+    d->addr = mmap(0, d->size, PROT_READ | PROT_WRITE, MAP_SHARED, d->fd, 0);
+    if (d->addr == MAP_FAILED) {
+        d->addr = NULL;
+        display_close(id);
+        return -1;
+    }
+    return id;
+}
+
+int display_open(const char *path) {
+    return display_open_bpp(path, 0);
+}
+
+
+/*
+    Create (or truncate) a regular file at PATH, size it for a WIDTH x
+    HEIGHT RGB565 display and map it like a framebuffer. Lets several
+    "displays" be driven and inspected on a machine without any. Returns
+    the display id, or -1 if the file cannot be created, sized or mapped.
+*/
+int display_open_fake(const char *path, int width, int height) {
+    int id = display_slot();
+    display_t *d;
+
+    if (id < 0) { return -1; }
+    d = &displays[id];
+    d->fake = 1;
+    d->mode_changed = 0;
+    d->cmap_saved = 0;
+    d->addr = NULL;
+    if (width <= 0 || height <= 0) { return -1; }
+    d->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (d->fd < 0) { d->fd = -1; return -1; }
+
+    memset(&d->var, 0, sizeof(d->var));
+    memset(&d->fix, 0, sizeof(d->fix));
+    d->var.xres = d->var.xres_virtual = width;
+    d->var.yres = d->var.yres_virtual = height;
+    d->var.bits_per_pixel = 16;
+    d->fix.line_length = width * sizeof(color_t);
+
+    d->size = (size_t)height * d->fix.line_length;
+    if (ftruncate(d->fd, d->size) < 0) {
+        display_close(id);
+        return -1;
+    }
+    d->addr = mmap(0, d->size, PROT_READ | PROT_WRITE, MAP_SHARED, d->fd, 0);
+    if (d->addr == MAP_FAILED) {
+        d->addr = NULL;
+        display_close(id);
+        return -1;
+    }
+    return id;
+}
+
+
+/*
+    Try /dev/fb0 .. /dev/fb7 and open every one that exists. Returns how
+    many were opened; their ids are the lowest free slots, in device order.
+*/
+int display_enumerate() {
+    char path[] = "/dev/fbN";
+    int n, count = 0;
+
+    for (n=0; n<MAX_DISPLAYS; n++) {
+        path[7] = '0' + n;
+        if (display_open(path) >= 0) { count++; }
+    }
+    return count;
+}
+
+
+/*
+    Make display ID the target of every drawing function in this thread.
+*/
+void display_select(int id) {
+    display_t *d = &displays[id];
+
+    display_addr = d->addr;
+    res_height = d->var.yres_virtual;                           // display-height resolution
+    res_width = (d->fix.line_length/(sizeof *display_addr));    // display-width resolution
+    index_addr = (unsigned char *)d->addr;
+    index_stride = d->fix.line_length;
+}
+
+
+/*
+    Unmap display ID, put back the mode and palette it had when it was
+    opened, close it and free its slot.
+*/
+void display_close(int id) {
+    display_t *d = &displays[id];
+    struct fb_cmap cmap;
+
+    if (d->fd < 0) { return; }
+    if (d->addr) { munmap(d->addr, d->size); }                  // NULL when open failed before the map
+    if (d->mode_changed) {
+        ioctl(d->fd, FBIOPUT_VSCREENINFO, &d->saved_var);
+    }
+    if (d->cmap_saved) {
+        cmap.start = 0;
+        cmap.len = PALETTE_SIZE;
+        cmap.red = d->saved_red;
+        cmap.green = d->saved_green;
+        cmap.blue = d->saved_blue;
+        cmap.transp = NULL;
+        ioctl(d->fd, FBIOPUTCMAP, &cmap);
+    }
+    close(d->fd);
+    d->fd = -1;
+}
+
+
+#ifndef NOLIBC
+/*
+    Thread body for display_start(): pin to the requested CPU, select the
+    display, then hand over to the render function.
+*/
+void *display_thread(void *arg) {
+    display_t *d = arg;
+    int id = d - displays;
+    cpu_set_t cpus;
+
+    if (d->cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(d->cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    display_select(id);
+    d->render(id, d->arg);
+    return NULL;
+}
+
+
+/*
+    Run RENDER(ID, ARG) on a new thread pinned to CPU (or any CPU if CPU is
+    -1) with display ID selected. Returns 0, or -1 if the thread could not
+    be created.
+*/
+int display_start(int id, int cpu, void (*render)(int id, void *arg), void *arg) {
+    display_t *d = &displays[id];
+    d->cpu = cpu;
+    d->render = render;
+    d->arg = arg;
+    return pthread_create(&d->thread, NULL, display_thread, d) ? -1 : 0;
+}
+
+
+/*
+    Wait for the render thread of display ID to return.
+*/
+void display_join(int id) {
+    pthread_join(displays[id].thread, NULL);
+}
+#endif
+
+
+/*
+    8-bit indexed color. In this mode every display byte is an index into a
+    256-entry hardware palette, so changing one palette entry recolors every
+    pixel that uses it with a single ioctl instead of rewriting the pixels.
+
+    The palette is shadowed in memory (palette_red/green/blue, 16 bits per
+    channel as struct fb_cmap wants). palette_set() only edits the shadow and
+    widens the dirty range; palette_commit() pushes the dirty range to the
+    hardware with one FBIOPUTCMAP.
+
+    int ioctl(int fd, FBIOGETCMAP / FBIOPUTCMAP, struct fb_cmap *cmap);
+
+    init_graphics_indexed() returns 0, or -1 (with everything closed again,
+    as by exit_graphics()) if the display cannot be opened or the driver
+    will not give an 8-bit pseudocolor mode.
+*/
+int init_graphics_indexed() {
+    if (init_graphics_bpp(8) < 0) { return -1; }
+    if (display_res.bits_per_pixel != 8 || display_depth.visual != FB_VISUAL_PSEUDOCOLOR) {
+        exit_graphics();                                    // restores the original mode and palette
+        return -1;
+    }
+    palette_load();
+    return 0;
+}
+
+
+/*
+    Manipulate the 8-bit display as a ROW MAJOR ORDER array of palette
+    indices, wrapping out-of-range coordinates like draw_pixel().
+*/
+void draw_pixel_index(int x, int y, color_index_t index) {
+    TRACE_CALL(TRACE_UNTRACED, 1, (long)UNTRACED_INDEXED);
+    if (x < 0 || x >= index_stride) { x = modulo(x, index_stride); }
+    if (y < 0 || y >= res_height) { y = modulo(y, res_height); }
+
+    index_addr[(y * index_stride) + x] = index;
+}
+
+
+/*
+    Fill the W x H rectangle at (X,Y) with one palette index, clipped to
+    the display.
+*/
+void fill_rect_index(int x, int y, int w, int h, color_index_t index) {
+    int x2 = x + w, y2 = y + h, col;
+    unsigned char *row;
+
+    TRACE_CALL(TRACE_UNTRACED, 1, (long)UNTRACED_INDEXED);
+    if (x < 0) { x = 0; }
+    if (y < 0) { y = 0; }
+    if (x2 > index_stride) { x2 = index_stride; }
+    if (y2 > res_height) { y2 = res_height; }
+
+    for (; y<y2; y++) {
+        row = index_addr + (y * index_stride);
+        for (col=x; col<x2; col++) { row[col] = index; }
+    }
+}
+
+
+/*
+    Read the current hardware palette into the shadow copy.
+*/
+void palette_load() {
+    struct fb_cmap cmap;
+    cmap.start = 0;
+    cmap.len = PALETTE_SIZE;
+    cmap.red = palette_red;
+    cmap.green = palette_green;
+    cmap.blue = palette_blue;
+    cmap.transp = NULL;
+    ioctl(fd_display, FBIOGETCMAP, &cmap);
+
+    palette_dirty_lo = PALETTE_SIZE;
+    palette_dirty_hi = -1;
+    palette_lookup_stale = 1;
+}
+
+
+/*
+    Set palette entry INDEX to the 0xRRGGBB color RGB (shadow only; call
+    palette_commit() or palette_frame() to show it). Indices outside
+    0..PALETTE_SIZE-1 are ignored. Animated entries are not in the
+    palette_nearest() table, so changing one leaves the table valid.
+*/
+void palette_set(int index, unsigned int rgb) {
+    if (index < 0 || index >= PALETTE_SIZE) { return; }
+    palette_red[index] = ((rgb >> 16) & 0xFF) * 257;        // 8 -> 16 bits: 0xAB -> 0xABAB
+    palette_green[index] = ((rgb >> 8) & 0xFF) * 257;
+    palette_blue[index] = (rgb & 0xFF) * 257;
+
+    if (index < palette_dirty_lo) { palette_dirty_lo = index; }
+    if (index > palette_dirty_hi) { palette_dirty_hi = index; }
+    if (!palette_animated[index]) { palette_lookup_stale = 1; }
+}
+
+
+/*
+    Read palette entry INDEX back as 0xRRGGBB (0 if out of range).
+*/
+unsigned int palette_get(int index) {
+    if (index < 0 || index >= PALETTE_SIZE) { return 0; }
+    return ((unsigned int)(palette_red[index] >> 8) << 16) |
+           ((unsigned int)(palette_green[index] >> 8) << 8) |
+           (palette_blue[index] >> 8);
+}
+
+
+/*
+    Send every entry changed since the last commit to the hardware in a
+    single FBIOPUTCMAP. Does nothing if nothing changed.
+*/
+void palette_commit() {
+    struct fb_cmap cmap;
+
+    if (palette_dirty_hi < palette_dirty_lo) { return; }
+    cmap.start = palette_dirty_lo;
+    cmap.len = palette_dirty_hi - palette_dirty_lo + 1;
+    cmap.red = palette_red + palette_dirty_lo;
+    cmap.green = palette_green + palette_dirty_lo;
+    cmap.blue = palette_blue + palette_dirty_lo;
+    cmap.transp = NULL;
+    ioctl(fd_display, FBIOPUTCMAP, &cmap);
+
+    palette_dirty_lo = PALETTE_SIZE;
+    palette_dirty_hi = -1;
+}
+
+
+/*
+    Nearest palette index for a 0xRRGGBB color. Lookups go through a table
+    of 4096 entries (4 bits per channel) that is rebuilt only when the
+    palette has changed since the last lookup, so converting a color is one
+    array read. Entries used by a running palette animation are never
+    returned: their color changes every few frames, so the table leaves
+    them out and an animation step does not force a rebuild. Index 0 is
+    returned if every entry is animated.
+*/
+color_index_t palette_nearest(unsigned int rgb) {
+    int i, p, r, g, b, dr, dg, db, dist, best, best_dist;
+
+    if (palette_lookup_stale) {
+        for (i=0; i<4096; i++) {
+            r = (((i >> 8) & 0xF) << 4) | 8;                // centre of the 4-bit cell, 0..255
+            g = (((i >> 4) & 0xF) << 4) | 8;
+            b = ((i & 0xF) << 4) | 8;
+            best = 0;
+            best_dist = 0x7FFFFFFF;
+            for (p=0; p<PALETTE_SIZE; p++) {
+                if (palette_animated[p]) { continue; }
+                dr = r - (palette_red[p] >> 8);
+                dg = g - (palette_green[p] >> 8);
+                db = b - (palette_blue[p] >> 8);
+                dist = dr*dr + dg*dg + db*db;
+                if (dist < best_dist) { best_dist = dist; best = p; }
+            }
+            palette_lookup[i] = best;
+        }
+        palette_lookup_stale = 0;
+    }
+
+    return palette_lookup[((rgb >> 12) & 0xF00) | ((rgb >> 8) & 0xF0) | ((rgb >> 4) & 0xF)];
+}
+
+
+/*
+    Palette animations, advanced once per frame by palette_frame():
+
+        palette_cycle(FIRST, COUNT, PERIOD)     rotate entries FIRST..FIRST+COUNT-1 by one every PERIOD frames
+        palette_blink(INDEX, A, B, PERIOD)      swap entry INDEX between colors A and B every PERIOD frames
+
+    Both return an animation id for palette_stop(), or -1 if the entries
+    are not all inside 0..PALETTE_SIZE-1 or all PALETTE_MAX_ANIMS slots are
+    busy.
+*/
+int palette_add_anim(int kind, int first, int count, int period, unsigned int a, unsigned int b) {
+    int id, i;
+    if (first < 0 || count < 1 || count > PALETTE_SIZE - first) { return -1; }
+    for (id=0; id<PALETTE_MAX_ANIMS; id++) {
+        if (palette_anims[id].kind == PALETTE_ANIM_NONE) {
+            palette_anims[id].kind = kind;
+            palette_anims[id].first = first;
+            palette_anims[id].count = count;
+            palette_anims[id].period = (period > 0) ? period : 1;
+            palette_anims[id].timer = 0;
+            palette_anims[id].phase = 0;
+            palette_anims[id].a = a;
+            palette_anims[id].b = b;
+            for (i=first; i<first+count; i++) { palette_animated[i]++; }
+            palette_lookup_stale = 1;                       // these entries leave the lookup table
+            return id;
+        }
+    }
+    return -1;
+}
+
+int palette_cycle(int first, int count, int period) {
+    return palette_add_anim(PALETTE_ANIM_CYCLE, first, count, period, 0, 0);
+}
+
+int palette_blink(int index, unsigned int a, unsigned int b, int period) {
+    int id = palette_add_anim(PALETTE_ANIM_BLINK, index, 1, period, a, b);
+    if (id >= 0) { palette_set(index, a); }
+    return id;
+}
+
+void palette_stop(int id) {
+    palette_anim_t *anim;
+    int i;
+
+    if (id < 0 || id >= PALETTE_MAX_ANIMS) { return; }
+    anim = &palette_anims[id];
+    if (anim->kind == PALETTE_ANIM_NONE) { return; }
+    anim->kind = PALETTE_ANIM_NONE;
+    for (i=anim->first; i<anim->first+anim->count; i++) { palette_animated[i]--; }
+    palette_lookup_stale = 1;                               // the entries are back in the lookup table
+}
+
+
+/*
+    Advance every palette animation by one frame and commit whatever
+    changed with (at most) one FBIOPUTCMAP. Call once per frame.
+*/
+void palette_frame() {
+    int id, i, last;
+    unsigned short r, g, b;
+    palette_anim_t *anim;
+
+    for (id=0; id<PALETTE_MAX_ANIMS; id++) {
+        anim = &palette_anims[id];
+        if (anim->kind == PALETTE_ANIM_NONE || ++anim->timer < anim->period) { continue; }
+        anim->timer = 0;
+
+        if (anim->kind == PALETTE_ANIM_BLINK) {
+            anim->phase ^= 1;
+            palette_set(anim->first, anim->phase ? anim->b : anim->a);
+        } else if (anim->count > 1) {                       // PALETTE_ANIM_CYCLE: last entry wraps to first
+            last = anim->first + anim->count - 1;
+            r = palette_red[last];
+            g = palette_green[last];
+            b = palette_blue[last];
+            for (i=last; i>anim->first; i--) {
+                palette_red[i] = palette_red[i-1];
+                palette_green[i] = palette_green[i-1];
+                palette_blue[i] = palette_blue[i-1];
+            }
+            palette_red[anim->first] = r;
+            palette_green[anim->first] = g;
+            palette_blue[anim->first] = b;
+
+            if (anim->first < palette_dirty_lo) { palette_dirty_lo = anim->first; }
+            if (last > palette_dirty_hi) { palette_dirty_hi = last; }
+        }
+    }
+
+    palette_commit();
 }
 
 
@@ -146,6 +953,7 @@ char getkey() {
         read(0, &c, sizeof(char));      //read into an int the size of one character
     }
 
+    TRACE_CALL(TRACE_KEY, 1, (long)c);
     return c;
 }
 
@@ -158,6 +966,7 @@ char getkey() {
     dedicated for each pixel (color_t). This is represented as res_width.
 */
 void draw_pixel(int x, int y, color_t color) {
+    TRACE_CALL(TRACE_PIXEL, 3, (long)x, (long)y, (long)color);
     if (x < 0 || x >= res_width) { x = modulo(x, res_width); }      // keep within X boundary
     if (y < 0 || y >= res_height) { y = modulo(y, res_height); }    // keep within Y boundary
 
@@ -182,6 +991,8 @@ void draw_line(int x1, int y1, int x2, int y2, color_t c) {
     int sy = y1<y2 ? 1 : -1;                    // get source y direction
     int err = (dx>dy ? dx : -dy)/2, e2;         // determine standard error for line
 
+    TRACE_CALL(TRACE_LINE, 5, (long)x1, (long)y1, (long)x2, (long)y2, (long)c);
+    TRACE_MUTE(1);                              // the draw_pixel() calls below are part of this line
     while(1) {
         //sleep_ms(1);                          // DEBUG
         draw_pixel(x1, y1, c);                  // draw a point of the line
@@ -190,6 +1001,253 @@ void draw_line(int x1, int y1, int x2, int y2, color_t c) {
         if (e2 >-dx) { err -= dy; x1 += sx; }   // determine new X point according to standard error
         if (e2 < dy) { err += dx; y1 += sy; }   // determine new Y point according to standard error
     }
+    TRACE_MUTE(-1);
+}
+
+
+/*
+    Batched line drawing for plotting workloads. Coordinates are passed as
+    flat arrays of ints:
+
+        draw_polyline():  { x0,y0, x1,y1, x2,y2, ... }      COUNT points, COUNT-1 connected segments
+        draw_lines():     { x1,y1,x2,y2, x1,y1,x2,y2, ... } COUNT independent segments
+
+    Unlike draw_pixel(), these CLIP to the display instead of wrapping. The
+    bounding box of the whole batch is checked once: a batch entirely off
+    screen returns immediately, and a batch entirely on screen is drawn with
+    no per-pixel bounds checks at all. Segments that cross the display edge
+    are cut to their visible steps first, so off-screen pixels cost nothing.
+*/
+#define SEG_SKIP_LAST 1     // leave the end point for the next segment (shared polyline joint)
+#define SEG_INSIDE    2     // caller guarantees the segment is on screen
+
+
+/*
+    Bresenham's algorithm again, but writing straight into display memory and
+    stepping a pixel pointer instead of recomputing (y * res_width) + x for
+    every point. Always draws max(dx,dy)+1 pixels, or one fewer with
+    SEG_SKIP_LAST, minus any that fall off the display.
+
+    With L = max(dx,dy) and M = min(dx,dy), step K moves the major axis K
+    pixels and the minor axis floor((K*M + L-1 - L/2) / L) pixels, and the
+    error term is L/2 - K*M + (minor pixels)*L (negated when Y is major).
+    That closed form lets a partly visible segment jump straight to its
+    first visible step and draw exactly the pixels the full walk would.
+*/
+void draw_segment(int x1, int y1, int x2, int y2, color_t c, int flags) {
+    int dx = abs(x2-x1);
+    int sx = x1<x2 ? 1 : -1;
+    int dy = abs(y2-y1);
+    int sy = y1<y2 ? 1 : -1;
+    int err = (dx>dy ? dx : -dy)/2, e2;
+    int steps = (dx>dy ? dx : dy) + ((flags & SEG_SKIP_LAST) ? 0 : 1);
+    long long major = (dx>dy) ? dx : dy, minor = (dx>dy) ? dy : dx;
+    long long bias = major - 1 - major/2;
+    long long k0 = 0, k1 = steps - 1, j;
+    color_t *p;
+
+    if (!(flags & SEG_INSIDE)) {
+        if ((x1<0 && x2<0) || (y1<0 && y2<0) ||
+            (x1>=res_width && x2>=res_width) || (y1>=res_height && y2>=res_height)) {
+            return;                                             // trivially outside the display
+        }
+        if (x1<0 || x2<0 || y1<0 || y2<0 ||
+            x1>=res_width || x2>=res_width || y1>=res_height || y2>=res_height) {
+            if (major == 0) {                                   // a single point, already known visible
+                if (steps) { display_addr[(y1 * res_width) + x1] = c; }
+                return;
+            }
+            if (dx > dy) {                                      // partially visible: clip the step range
+                segment_clip_axis(x1, sx, major, 0, major, res_width, &k0, &k1);
+                segment_clip_axis(y1, sy, minor, bias, major, res_height, &k0, &k1);
+            } else {
+                segment_clip_axis(x1, sx, minor, bias, major, res_width, &k0, &k1);
+                segment_clip_axis(y1, sy, major, 0, major, res_height, &k0, &k1);
+            }
+            if (k0 > k1) { return; }
+
+            j = floor_div_ll(k0 * minor + bias, major);         // minor-axis pixels moved by step K0
+            if (dx > dy) {
+                x1 += sx * k0;
+                y1 += sy * j;
+                err = major/2 - k0 * minor + j * major;
+            } else {
+                x1 += sx * j;
+                y1 += sy * k0;
+                err = -(major/2 - k0 * minor + j * major);
+            }
+            steps = k1 - k0 + 1;
+        }
+    }
+
+    p = display_addr + (y1 * res_width) + x1;                   // fully visible: no checks
+    sy *= res_width;                                            // one row step in pixels
+    while (steps--) {
+        *p = c;
+        e2 = err;
+        if (e2 >-dx) { err -= dy; p += sx; }
+        if (e2 < dy) { err += dx; p += sy; }
+    }
+}
+
+
+/*
+    Narrow the step range [*k0, *k1] of a draw_segment() walk to the steps K
+    where the coordinate P + S * floor((K*NUM + BIAS) / DEN) stays inside
+    [0, LIMIT). The offset never decreases with K, so the visible steps are
+    one contiguous run.
+*/
+void segment_clip_axis(int p, int s, long long num, long long bias, long long den, int limit, long long *k0, long long *k1) {
+    long long jlo = (s > 0) ? -(long long)p : (long long)p - limit + 1;     // offsets that stay on screen
+    long long jhi = (s > 0) ? (long long)limit - 1 - p : (long long)p;
+    long long a, b;
+
+    if (num == 0) {
+        a = floor_div_ll(bias, den);                            // constant offset
+        if (a < jlo || a > jhi) { *k1 = *k0 - 1; }
+        return;
+    }
+    a = -floor_div_ll(bias - jlo * den, num);                   // first K with offset >= jlo
+    b = floor_div_ll((jhi + 1) * den - bias - 1, num);          // last K with offset <= jhi
+    if (a > *k0) { *k0 = a; }
+    if (b < *k1) { *k1 = b; }
+}
+
+
+/*
+    Fill the vertical run of pixels from (x,y1) to (x,y2) inclusive, clipped
+    to the display.
+*/
+void draw_column(int x, int y1, int y2, color_t c) {
+    color_t *p;
+    int t;
+
+    if (x < 0 || x >= res_width) { return; }
+    if (y1 > y2) { t = y1; y1 = y2; y2 = t; }
+    if (y1 < 0) { y1 = 0; }
+    if (y2 >= res_height) { y2 = res_height - 1; }
+
+    for (p = display_addr + (y1 * res_width) + x; y1 <= y2; y1++, p += res_width) {
+        *p = c;
+    }
+}
+
+
+/*
+    Column-span fast path for polylines whose X never decreases (time-series
+    plots). Each column gets exactly one vertical span running from where the
+    line enters the column to just before where it enters the next, so every
+    pixel is written once and neighbouring segments never overlap.
+
+    The line's Y at column X is y1 + floor((2*dy*(X-x1) + dx) / (2*dx)), which
+    is stepped incrementally as a quotient and remainder: no division in the
+    column loop. Only columns inside the display are visited; a segment that
+    starts off the left edge computes its Y at column 0 directly.
+*/
+void draw_polyline_columns(const int *points, int count, color_t c) {
+    int i, x, x1, y1, x2, y2, xa, xb, dx, dy, q, r, rem, ya, yb, last;
+    long long t;
+
+    for (i=0; i<count-1; i++) {
+        x1 = points[2*i];     y1 = points[2*i+1];
+        x2 = points[2*i+2];   y2 = points[2*i+3];
+        dx = x2 - x1;
+        dy = y2 - y1;
+        last = (i == count-2);
+
+        if (dx == 0) {                                          // vertical step within one column
+            if (y1 != y2) { draw_column(x1, y1, y2 - (dy>0 ? 1 : -1), c); }
+        } else {
+            q = (2*dy) / (2*dx);                                // floor(2dy / 2dx) and its remainder
+            r = (2*dy) - q*(2*dx);
+            if (r < 0) { q--; r += 2*dx; }
+
+            xa = (x1 < 0) ? 0 : x1;                             // visible columns only
+            xb = (x2 > res_width) ? res_width : x2;
+            t = 2LL*dy*(xa - x1) + dx;
+            ya = y1 + (int)floor_div_ll(t, 2LL*dx);             // Y where the line enters column xa
+            rem = (int)(t - (ya - y1) * 2LL*dx);
+            for (x=xa; x<xb; x++) {
+                yb = ya + q;                                    // Y where the line enters column x+1
+                rem += r;
+                if (rem >= 2*dx) { rem -= 2*dx; yb++; }
+
+                draw_column(x, ya, (yb == ya) ? ya : yb - (yb>ya ? 1 : -1), c);
+                ya = yb;
+            }
+        }
+
+        if (last) { draw_column(x2, y2, y2, c); }               // final end point
+    }
+}
+
+
+/*
+    Draw COUNT points joined by COUNT-1 segments. Each joint is drawn exactly
+    once: every segment but the last leaves its end point for the next one.
+*/
+void draw_polyline(const int *points, int count, color_t c) {
+    int i, flags, monotonic = 1;
+    int minx, maxx, miny, maxy;
+
+    if (count <= 0) { return; }
+    TRACE_POINTS(TRACE_POLYLINE, points, count, 2, c);
+
+    minx = maxx = points[0];
+    miny = maxy = points[1];
+    for (i=1; i<count; i++) {                                   // batch bounding box and X order
+        if (points[2*i] < points[2*i-2]) { monotonic = 0; }
+        if (points[2*i] < minx) { minx = points[2*i]; }
+        if (points[2*i] > maxx) { maxx = points[2*i]; }
+        if (points[2*i+1] < miny) { miny = points[2*i+1]; }
+        if (points[2*i+1] > maxy) { maxy = points[2*i+1]; }
+    }
+    if (maxx < 0 || maxy < 0 || minx >= res_width || miny >= res_height) { return; }
+
+    if (count == 1) {
+        draw_column(points[0], points[1], points[1], c);
+        return;
+    }
+
+    if (monotonic) {
+        draw_polyline_columns(points, count, c);
+        return;
+    }
+
+    flags = (minx >= 0 && miny >= 0 && maxx < res_width && maxy < res_height) ? SEG_INSIDE : 0;
+    for (i=0; i<count-1; i++) {
+        draw_segment(points[2*i], points[2*i+1], points[2*i+2], points[2*i+3], c,
+                     flags | ((i < count-2) ? SEG_SKIP_LAST : 0));
+    }
+}
+
+
+/*
+    Draw COUNT independent segments.
+*/
+void draw_lines(const int *segments, int count, color_t c) {
+    int i, v, flags;
+    int minx, maxx, miny, maxy;
+
+    if (count <= 0) { return; }
+    TRACE_POINTS(TRACE_LINES, segments, count, 4, c);
+
+    minx = maxx = segments[0];
+    miny = maxy = segments[1];
+    for (i=0; i<2*count; i++) {                                 // batch bounding box over every end point
+        v = segments[2*i];
+        if (v < minx) { minx = v; }
+        if (v > maxx) { maxx = v; }
+        v = segments[2*i+1];
+        if (v < miny) { miny = v; }
+        if (v > maxy) { maxy = v; }
+    }
+    if (maxx < 0 || maxy < 0 || minx >= res_width || miny >= res_height) { return; }
+
+    flags = (minx >= 0 && miny >= 0 && maxx < res_width && maxy < res_height) ? SEG_INSIDE : 0;
+    for (i=0; i<count; i++) {
+        draw_segment(segments[4*i], segments[4*i+1], segments[4*i+2], segments[4*i+3], c, flags);
+    }
 }
 
 
@@ -202,18 +1260,34 @@ void draw_line(int x1, int y1, int x2, int y2, color_t c) {
 void draw_text(int x, int y, const char *text, color_t c) {
     int pos = 0;
     int cur_char;
+    TRACE_TEXT_CALL(x, y, text, c);
+    TRACE_MUTE(1);                                      // the draw_char() calls are part of this text
     while ((cur_char = text[pos++]) != '\0') {          // loop until reach NULL terminator
         draw_char(x, y, cur_char, c);
         x+=10;                                          // move in front of next character (with 2-pixel spacing)
     }
+    TRACE_MUTE(-1);
 }
 
 
 /*
     Prints out the given character using the iso_font.h character map.
+
+    A character that is entirely on the display is drawn a row at a time by
+    the glyph kernel; one that crosses an edge wraps pixel by pixel exactly
+    like draw_pixel().
 */
 void draw_char(int x, int y, const int c, color_t color) {
     int row, col, char_pixel;
+    TRACE_CALL(TRACE_CHAR, 4, (long)x, (long)y, (long)c, (long)color);
+    if (x >= 0 && y >= 0 && x + 8 <= res_width && y + 16 <= res_height) {
+        for (row=0; row<16; row++) {                    // fully on screen: expand whole rows at once
+            kernels.glyph(display_addr + ((y + row) * res_width) + x, iso_font[(c*16) + row], 8, color);
+        }
+        return;
+    }
+
+    TRACE_MUTE(1);
     for (row=0; row<16; row++) {                        // 16 rows per character
         char_pixel = iso_font[(c*16) + row];            // get current pixel data
 
@@ -223,52 +1297,1480 @@ void draw_char(int x, int y, const int c, color_t color) {
             }
         }
     }
+    TRACE_MUTE(-1);
 }
 
 
 /*
-    Lazy absolute value function
-*/
-int abs(int value) {
-    if (value < 0) { value = -value; }
-    return value;
-}
+    Affine bitmap blit. M is the FORWARD transform from source pixels to the
+    display, as six 16.16 fixed-point numbers:
 
+        [ dst_x ]   [ m[0]  m[1]  m[2] ]   [ src_x ]
+        [ dst_y ] = [ m[3]  m[4]  m[5] ] * [ src_y ]
+                                           [   1   ]
 
-/*
-    The internal '%' C operator performs what is known as
-    a "remainder" operation; returning the positive, or
-    negative, remainder of the result.
+    e.g. a 2x thumbnail at (100,50) is { FIXED(2), 0, FIXED(100), 0, FIXED(2), FIXED(50) }.
 
-    When calculating where pixels should be drawn on the
-    screen, we only care about the positive remainder.
-    This is because we only want to draw within the legal
-    bounds of the display.
+    The transform is inverted once, then for each display row in the
+    transformed bounding box the span of X where the sample lands inside the
+    source is solved directly. The inner loop only adds 16.16 increments
+    (du, dv) and never tests bounds. Pixels are sampled at their centres.
+    Rows go through kernels.nearest / kernels.bilinear: the scalar versions
+    below, or SIMD ones from kernels.h that do the coordinate and blend
+    arithmetic for a vector of pixels at once.
 
-    https://stackoverflow.com/a/42131603/5635772
+    Pure integer 2x, 3x and 4x scales with whole-pixel offsets (and the
+    NEAREST filter) skip sampling entirely and replicate pixels and rows.
 */
-int modulo(int x, int N) {
-    return (x % N + N) %N;
+void draw_bitmap_affine(const bitmap_t *src, const fixed_t m[6], int filter) {
+    double det, ia, ib, ic, id, ie, iff, px, py;
+    double cx[4], cy[4], lx, hx, ly, hy;
+    fixed_t u0, v0, du, dv, uy, vy;
+    int i, y, minx, maxx, miny, maxy, lo, hi;
+    color_t *dst;
+
+    if (src->width <= 0 || src->height <= 0) { return; }
+    TRACE_CALL(TRACE_UNTRACED, 1, (long)UNTRACED_BITMAP);
+
+    if (filter == BLIT_NEAREST && m[1] == 0 && m[3] == 0 && m[0] == m[4] &&
+        (m[0] == FIXED(2) || m[0] == FIXED(3) || m[0] == FIXED(4)) &&
+        (m[2] & 0xFFFF) == 0 && (m[5] & 0xFFFF) == 0) {
+        TRACE_MUTE(1);
+        draw_bitmap_upscale(src, m[0] >> 16, m[2] >> 16, m[5] >> 16);
+        TRACE_MUTE(-1);
+        return;
+    }
+
+    det = ((double)m[0] * m[4] - (double)m[1] * m[3]) / 65536.0 / 65536.0;
+    if (det == 0) { return; }                                   // degenerate: collapses to a line
+
+    ia =  (m[4] / 65536.0) / det;                               // inverse transform (display -> source)
+    ib = -(m[1] / 65536.0) / det;
+    id = -(m[3] / 65536.0) / det;
+    ie =  (m[0] / 65536.0) / det;
+    ic = -(ia * (m[2] / 65536.0) + ib * (m[5] / 65536.0));
+    iff = -(id * (m[2] / 65536.0) + ie * (m[5] / 65536.0));
+    if (!fixed_fits(ia) || !fixed_fits(ib) || !fixed_fits(id) || !fixed_fits(ie)) {
+        return;                                                 // nearly singular: steps overflow 16.16
+    }
+
+    for (i=0; i<4; i++) {                                       // transformed corners -> bounding box
+        px = (i & 1) ? src->width : 0;
+        py = (i & 2) ? src->height : 0;
+        cx[i] = (m[0] * px + m[1] * py + m[2]) / 65536.0;
+        cy[i] = (m[3] * px + m[4] * py + m[5]) / 65536.0;
+    }
+    lx = hx = cx[0];
+    ly = hy = cy[0];
+    for (i=1; i<4; i++) {
+        if (cx[i] < lx) { lx = cx[i]; }
+        if (cx[i] > hx) { hx = cx[i]; }
+        if (cy[i] < ly) { ly = cy[i]; }
+        if (cy[i] > hy) { hy = cy[i]; }
+    }
+    if (hx < 0 || hy < 0 || lx >= res_width || ly >= res_height) { return; }
+    minx = (lx < 1) ? 0 : (int)lx - 1;                          // clip in double, so the casts cannot overflow
+    miny = (ly < 1) ? 0 : (int)ly - 1;
+    maxx = (hx >= res_width - 1) ? res_width - 1 : (int)hx + 1;
+    maxy = (hy >= res_height - 1) ? res_height - 1 : (int)hy + 1;
+
+    for (i=0; i<4; i++) {                                       // source coordinates at the box corners
+        px = ((i & 1) ? maxx : minx) + 0.5;
+        py = ((i & 2) ? maxy : miny) + 0.5;
+        if (!fixed_fits(ia * px + ib * py + ic) || !fixed_fits(id * px + ie * py + iff)) {
+            return;                                             // samples run outside the 16.16 range
+        }
+    }
+
+    du = (fixed_t)(ia * 65536.0);                               // source step per display pixel
+    dv = (fixed_t)(id * 65536.0);
+    uy = (fixed_t)(ib * 65536.0);                               // source step per display row
+    vy = (fixed_t)(ie * 65536.0);
+    u0 = (fixed_t)((ia * (minx + 0.5) + ib * (miny + 0.5) + ic) * 65536.0);
+    v0 = (fixed_t)((id * (minx + 0.5) + ie * (miny + 0.5) + iff) * 65536.0);
+
+    for (y=miny; y<=maxy; y++, u0 += uy, v0 += vy) {
+        lo = 0;
+        hi = maxx - minx;
+        blit_span_limit(u0, du, src->width, &lo, &hi);          // display columns that land inside the source
+        blit_span_limit(v0, dv, src->height, &lo, &hi);
+        if (lo > hi) { continue; }
+
+        dst = display_addr + (y * res_width) + minx;
+        if (filter == BLIT_BILINEAR) {
+            kernels.bilinear(dst + lo, src, (fixed_t)(u0 + (long long)lo*du), (fixed_t)(v0 + (long long)lo*dv), du, dv, hi - lo + 1);
+        } else {
+            kernels.nearest(dst + lo, src, (fixed_t)(u0 + (long long)lo*du), (fixed_t)(v0 + (long long)lo*dv), du, dv, hi - lo + 1);
+        }
+    }
 }
 
 
 /*
-    Clear the screen by writing ANSI ESCAPE code "\033[2J".
-    The screen is STDOUT aka FD=1
-
-    ssize_t write(int FD, const void *BUF, size_t COUNT);
+    1 if V (in pixels) can be held as a 16.16 fixed_t.
 */
-void clear_screen() {
-    write(1, "\033[2J", 8);
+int fixed_fits(double v) {
+    return v > -32768.0 && v < 32767.0;
 }
 
 
 /*
-    Grabs the terminal settings and turns ICANON and ECHO flags
-    ON or OFF, depending on the input parameter "on".
+    Narrow the step range [*lo, *hi] to the steps K where the 16.16
+    coordinate P0 + K*DP stays inside [0, LIMIT) source pixels.
+*/
+void blit_span_limit(fixed_t p0, fixed_t dp, int limit, int *lo, int *hi) {
+    long long top = ((long long)limit << 16) - 1;               // largest in-range 16.16 value
+    long long a, b;
 
-    struct termios {
-        tcflag_t c_iflag;       // input modes
+    if (dp == 0) {
+        if (p0 < 0 || p0 > top) { *hi = *lo - 1; }
+        return;
+    }
+    if (dp > 0) {
+        a = -floor_div_ll(p0, dp);                              // first K with P >= 0   (ceil(-P0/DP))
+        b = floor_div_ll(top - p0, dp);                         // last K with P <= top
+    } else {
+        a = -floor_div_ll(p0 - top, dp);                        // first K with P <= top (ceil((top-P0)/DP))
+        b = floor_div_ll(-(long long)p0, dp);                   // last K with P >= 0
+    }
+    if (a > *lo) { *lo = (a > *hi) ? *hi + 1 : (int)a; }
+    if (b < *hi) { *hi = (b < *lo) ? *lo - 1 : (int)b; }
+}
+
+
+/*
+    Division that rounds toward negative infinity, unlike C's '/'.
+*/
+long long floor_div_ll(long long a, long long b) {
+    long long q = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0))) { q--; }
+    return q;
+}
+
+
+/*
+    Nearest-neighbour row: take the source pixel the sample falls in.
+    Scalar reference for kernels.nearest.
+*/
+void kernel_nearest_scalar(color_t *dst, const bitmap_t *src, fixed_t u, fixed_t v, fixed_t du, fixed_t dv, int n) {
+    const color_t *pixels = src->pixels;
+    int stride = src->stride;
+
+    if (dv == 0) {                                              // axis-aligned: one source row for the whole span
+        const color_t *row = pixels + (v >> 16) * stride;
+        while (n--) { *dst++ = row[u >> 16]; u += du; }
+        return;
+    }
+    while (n--) {
+        *dst++ = pixels[(v >> 16) * stride + (u >> 16)];
+        u += du;
+        v += dv;
+    }
+}
+
+
+/*
+    RGB565 with the three channels pulled apart so one 32-bit multiply scales
+    all of them at once: green goes to the top half, red and blue stay put,
+    and every channel gets at least 5 spare bits above it for a 0..32 weight.
+
+        ----- GGGGGG ----- RRRRR ------ BBBBB
+*/
+#define RGB565_SPREAD(c) ((((unsigned int)(c) << 16) | (c)) & 0x07E0F81F)
+#define RGB565_PACK(s)   ((color_t)(((s) >> 16) | (s)))
+#define RGB565_LERP(a, b, w) (((((a) * (32 - (w))) + ((b) * (w))) >> 5) & 0x07E0F81F)
+
+/*
+    Bilinear row: blend the 2x2 source pixels around the sample with 5-bit
+    weights, clamping at the source edges. Scalar reference for
+    kernels.bilinear.
+*/
+void kernel_bilinear_scalar(color_t *dst, const bitmap_t *src, fixed_t u, fixed_t v, fixed_t du, fixed_t dv, int n) {
+    const color_t *pixels = src->pixels;
+    int stride = src->stride;
+    int w1 = src->width - 1, h1 = src->height - 1;
+    int x0, y0, x1, y1, fx, fy;
+    unsigned int top, bottom;
+    fixed_t su, sv;
+
+    while (n--) {
+        su = u - 0x8000;                                        // sample centres sit at +0.5
+        sv = v - 0x8000;
+        x0 = su >> 16;
+        y0 = sv >> 16;
+        fx = (su >> 11) & 31;
+        fy = (sv >> 11) & 31;
+        if (x0 < 0) { x0 = 0; fx = 0; }
+        if (y0 < 0) { y0 = 0; fy = 0; }
+        x1 = (x0 < w1) ? x0 + 1 : w1;
+        y1 = (y0 < h1) ? y0 + 1 : h1;
+
+        top = RGB565_LERP(RGB565_SPREAD(pixels[y0*stride + x0]), RGB565_SPREAD(pixels[y0*stride + x1]), fx);
+        bottom = RGB565_LERP(RGB565_SPREAD(pixels[y1*stride + x0]), RGB565_SPREAD(pixels[y1*stride + x1]), fx);
+        *dst++ = RGB565_PACK(RGB565_LERP(top, bottom, fy));
+
+        u += du;
+        v += dv;
+    }
+}
+
+
+/*
+    Integer upscale fast path: each source pixel becomes a KxK block. A
+    source row is expanded into the display once, then the next K-1 display
+    rows are straight copies of it.
+*/
+void draw_bitmap_upscale(const bitmap_t *src, int k, int tx, int ty) {
+    int x0 = tx, y0 = ty, x1 = tx + src->width * k, y1 = ty + src->height * k;
+    int x, y, sx, n;
+    const color_t *row;
+    color_t *dst, c;
+
+    TRACE_CALL(TRACE_UNTRACED, 1, (long)UNTRACED_BITMAP);
+    if (x0 < 0) { x0 = 0; }
+    if (y0 < 0) { y0 = 0; }
+    if (x1 > res_width) { x1 = res_width; }
+    if (y1 > res_height) { y1 = res_height; }
+    if (x0 >= x1 || y0 >= y1) { return; }
+
+    for (y=y0; y<y1; y++) {
+        dst = display_addr + (y * res_width);
+
+        if (y > y0 && (y - ty) % k != 0) {                      // repeat of the row above
+            kernels.copy(dst + x0, dst + x0 - res_width, x1 - x0);
+            continue;
+        }
+
+        row = src->pixels + ((y - ty) / k) * src->stride;
+        x = x0;
+        sx = (x0 - tx) / k;
+        for (n = k - (x0 - tx) % k; n > 0 && x < x1; n--) {     // partial block clipped on the left
+            dst[x++] = row[sx];
+        }
+        sx++;
+        for (; x + k <= x1; x += k, sx++) {                     // whole blocks
+            c = row[sx];
+            switch (k) {
+                case 4: dst[x+3] = c;   /* fall through */
+                case 3: dst[x+2] = c;   /* fall through */
+                default: dst[x+1] = c; dst[x] = c;
+            }
+        }
+        for (; x < x1; x++) {                                   // partial block clipped on the right
+            dst[x] = row[sx];
+        }
+    }
+}
+
+
+/*
+    Shape fills. Each shape is reduced to horizontal spans, and every span
+    is handed to fill_span() which generates the colors for the whole run
+    at once according to the fill_t style:
+
+        FILL_SOLID      one color
+        FILL_LINEAR     two-color gradient from (x0,y0) to (x1,y1)
+        FILL_RADIAL     two-color gradient from centre (x0,y0) out to radius x1
+        FILL_PATTERN    8x8 bit pattern, color where set, background where clear
+        FILL_BITMAP     tiled bitmap
+
+    Patterns, tiles and gradients are anchored to the display, not to the
+    shape, so neighbouring shapes line up. Gradients are interpolated with
+    8 bits per channel and ordered-dithered down to RGB565 to avoid banding.
+*/
+const unsigned char dither_4x4[4][4] = {        // Bayer ordered-dither thresholds 0..15
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+
+/*
+    Integer square root (floor) by the bit-by-bit method.
+*/
+unsigned int isqrt(unsigned long long n) {
+    unsigned long long root = 0, bit = 1ULL << 62;
+    while (bit > n) { bit >>= 2; }
+    while (bit) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (unsigned int)root;
+}
+
+
+/*
+    Gradient color for position T (16.16, clamped to 0..1) at display pixel
+    (X,Y): blend the two 0xRRGGBB end colors, then add the Bayer threshold
+    for this pixel before dropping to 5/6/5 bits.
+*/
+static inline color_t gradient_color(const fill_t *f, int t, int x, int y) {
+    int r, g, b, d = dither_4x4[y & 3][x & 3];
+
+    t >>= 8;                                            // 0..256
+    if (t < 0) { t = 0; }
+    if (t > 256) { t = 256; }
+
+    r = ((f->from >> 16) & 0xFF) + (((((int)(f->to >> 16) & 0xFF) - (int)((f->from >> 16) & 0xFF)) * t) >> 8);
+    g = ((f->from >> 8) & 0xFF) + (((((int)(f->to >> 8) & 0xFF) - (int)((f->from >> 8) & 0xFF)) * t) >> 8);
+    b = (f->from & 0xFF) + ((((int)(f->to & 0xFF) - (int)(f->from & 0xFF)) * t) >> 8);
+
+    r = (r + (d >> 1)) >> 3;                            // 8 -> 5 bits, threshold 0..7
+    g = (g + (d >> 2)) >> 2;                            // 8 -> 6 bits, threshold 0..3
+    b = (b + (d >> 1)) >> 3;
+    if (r > 31) { r = 31; }
+    if (g > 63) { g = 63; }
+    if (b > 31) { b = 31; }
+
+    return (color_t)((r << 11) | (g << 5) | b);
+}
+
+
+/*
+    Fill N pixels of display row Y starting at X with the given style. The
+    caller has already clipped the span to the display.
+
+    Gradients step their parameter incrementally along the span: T for a
+    linear gradient grows by a constant (kept as a whole part plus a
+    remainder over the squared length, so it is exact and never drifts),
+    and the distance for a radial one changes by at most one pixel per
+    step, so its square root is nudged from the previous pixel's value
+    instead of recomputed. T is produced
+    FILL_CHUNK pixels at a time and kernels.gradient turns each chunk into
+    dithered colors; patterns go through kernels.pattern and tiles through
+    kernels.copy, one run per tile repeat.
+*/
+#define FILL_CHUNK 64
+
+void fill_span(int x, int y, int n, const fill_t *f) {
+    color_t *dst = display_addr + (y * res_width) + x;
+    int ts[FILL_CHUNK] __attribute__((aligned(64)));
+    int i, m;
+
+    switch (f->style) {
+    case FILL_LINEAR: {
+        long long dx = f->x1 - f->x0, dy = f->y1 - f->y0;
+        long long len2 = dx*dx + dy*dy;
+        long long num, t, r, dt, dr;
+
+        if (len2 == 0) { len2 = 1; }
+        num = ((x - f->x0) * dx + (y - f->y0) * dy) * 65536;    // T * len2
+        t = floor_div_ll(num, len2);                            // T = t + r/len2, 0 <= r < len2
+        r = num - t * len2;
+        dt = floor_div_ll(dx * 65536, len2);                    // per pixel, split the same way
+        dr = dx * 65536 - dt * len2;
+        for (; n > 0; n -= m, dst += m, x += m) {
+            m = (n < FILL_CHUNK) ? n : FILL_CHUNK;
+            for (i=0; i<m; i++) {
+                ts[i] = (t < 0) ? 0 : (t > 65536) ? 65536 : (int)t;
+                t += dt;
+                r += dr;
+                if (r >= len2) { r -= len2; t++; }
+            }
+            kernels.gradient(dst, f, ts, x, y, m);
+        }
+        break;
+    }
+
+    case FILL_RADIAL: {
+        long long ex = (long long)(x - f->x0) * 16, ey = (long long)(y - f->y0) * 16;
+        unsigned long long d2 = ex*ex + ey*ey;          // squared distance in 1/16 pixel units
+        unsigned int s = isqrt(d2);
+        long long inv = (4096LL << 16) / (f->x1 > 0 ? f->x1 : 1);
+
+        for (; n > 0; n -= m, dst += m, x += m) {
+            m = (n < FILL_CHUNK) ? n : FILL_CHUNK;
+            for (i=0; i<m; i++) {
+                while ((unsigned long long)(s+1) * (s+1) <= d2) { s++; }
+                while ((unsigned long long)s * s > d2) { s--; }
+                ts[i] = (int)((s * inv) >> 16);
+
+                d2 += 32*ex + 256;                      // (ex+16)^2 - ex^2
+                ex += 16;
+            }
+            kernels.gradient(dst, f, ts, x, y, m);
+        }
+        break;
+    }
+
+    case FILL_PATTERN: {
+        unsigned int bits = f->pattern[y & 7];
+        bits |= bits << 8;                              // rotate the row so bit 0 is pixel X
+        kernels.pattern(dst, (bits >> (x & 7)) & 0xFF, f->color, f->background, n);
+        break;
+    }
+
+    case FILL_BITMAP: {
+        const bitmap_t *tile = f->tile;
+        const color_t *row;
+        int sx;
+
+        if (tile->width <= 0 || tile->height <= 0) { break; }  // empty tile: nothing to repeat
+        row = tile->pixels + modulo(y, tile->height) * tile->stride;
+        sx = modulo(x, tile->width);
+        for (; n > 0; n -= m, dst += m, sx = 0) {       // copy up to the tile's right edge, then wrap
+            m = (n < tile->width - sx) ? n : tile->width - sx;
+            kernels.copy(dst, row + sx, m);
+        }
+        break;
+    }
+
+    default:                                            // FILL_SOLID
+        kernels.fill(dst, f->color, n);
+        break;
+    }
+}
+
+
+/*
+    Clip the span [X1, X2] (inclusive) on row Y to the display and fill it.
+*/
+void fill_hspan(int x1, int x2, int y, const fill_t *f) {
+    if (y < 0 || y >= res_height) { return; }
+    if (x1 < 0) { x1 = 0; }
+    if (x2 >= res_width) { x2 = res_width - 1; }
+    if (x1 <= x2) { fill_span(x1, y, x2 - x1 + 1, f); }
+}
+
+
+/*
+    Fill the W x H rectangle whose upper-left corner is (X,Y).
+*/
+void fill_rect(int x, int y, int w, int h, const fill_t *f) {
+    int row;
+    TRACE_CALL(TRACE_FILL_RECT, 4, (long)x, (long)y, (long)w, (long)h);
+    TRACE_FILL_CALL(f);
+    for (row=y; row<y+h; row++) {
+        fill_hspan(x, x + w - 1, row, f);
+    }
+}
+
+
+/*
+    Fill the circle of radius R centred on (CX,CY). Each row's half-width is
+    the largest W with W^2 + DY^2 <= R^2.
+*/
+void fill_circle(int cx, int cy, int r, const fill_t *f) {
+    int dy, w;
+    TRACE_CALL(TRACE_FILL_CIRCLE, 3, (long)cx, (long)cy, (long)r);
+    TRACE_FILL_CALL(f);
+    for (dy=-r; dy<=r; dy++) {
+        w = isqrt((long long)r*r - (long long)dy*dy);
+        fill_hspan(cx - w, cx + w, cy + dy, f);
+    }
+}
+
+
+/*
+    Fill the polygon given as COUNT points { x0,y0, x1,y1, ... } (closed
+    automatically) using the even-odd rule. Each row is sampled through
+    pixel centres: find where the edges cross Y+0.5, sort the crossings,
+    and fill between pairs. At most POLY_MAX_CROSSINGS edges are considered
+    per row.
+*/
+#define POLY_MAX_CROSSINGS 256
+
+void fill_polygon(const int *points, int count, const fill_t *f) {
+    fixed_t crossings[POLY_MAX_CROSSINGS];
+    int i, j, n, y, miny, maxy, x0, y0, x1, y1;
+    fixed_t t;
+
+    if (count < 3) { return; }
+    TRACE_POINTS(TRACE_FILL_POLYGON, points, count, 2, 0);
+    TRACE_FILL_CALL(f);
+
+    miny = maxy = points[1];
+    for (i=1; i<count; i++) {
+        if (points[2*i+1] < miny) { miny = points[2*i+1]; }
+        if (points[2*i+1] > maxy) { maxy = points[2*i+1]; }
+    }
+    if (miny < 0) { miny = 0; }
+    if (maxy > res_height) { maxy = res_height; }
+
+    for (y=miny; y<maxy; y++) {
+        n = 0;
+        for (i=0; i<count && n<POLY_MAX_CROSSINGS; i++) {
+            j = (i + 1) % count;
+            x0 = points[2*i];  y0 = points[2*i+1];
+            x1 = points[2*j];  y1 = points[2*j+1];
+            if ((y0 <= y && y < y1) || (y1 <= y && y < y0)) {   // edge spans the row centre Y+0.5
+                t = (fixed_t)((long long)x0 * 65536 + (long long)(2*(y - y0) + 1) * (x1 - x0) * 32768 / (y1 - y0));
+                for (j=n++; j>0 && crossings[j-1] > t; j--) {   // insertion sort as we go
+                    crossings[j] = crossings[j-1];
+                }
+                crossings[j] = t;
+            }
+        }
+
+        for (i=0; i+1<n; i+=2) {                        // pixels whose centres lie in [a, b)
+            fill_hspan((crossings[i] + 0x7FFF) >> 16, ((crossings[i+1] + 0x7FFF) >> 16) - 1, y, f);
+        }
+    }
+}
+
+
+/*
+    Software sprites (cursor, indicators) with save-under buffers.
+
+    Before a sprite is drawn, the display pixels it covers are copied into
+    its save buffer; hiding it copies them back, so whatever was underneath
+    survives no matter how complex it was. The buffers are ordinary (cached)
+    memory, so restoring never has to read the framebuffer, which is often
+    uncached and slow to read.
+
+    sprite_move() does restore + save + draw without ever drawing the old
+    position's background only to cover it again: each pixel's true
+    background comes from the old save buffer if the sprite used to cover
+    it, otherwise from the display. Only pixels inside the old or the new
+    rectangle are visited, so a move costs at most two sprite areas of
+    pixels however far the sprite jumps and whatever the scene behind it.
+
+    The caller must hide a sprite before drawing underneath it, and sprites
+    must not overlap each other (hide them in reverse order if they do).
+*/
+
+/*
+    Reserve a sprite slot for IMAGE, treating pixels equal to KEY as
+    transparent. Returns the sprite id, or -1 if the image is too large or
+    no slot is free.
+*/
+int sprite_create(const bitmap_t *image, color_t key) {
+    int id;
+    if (image->width * image->height > SPRITE_MAX_PIXELS) { return -1; }
+    for (id=0; id<MAX_SPRITES; id++) {
+        if (sprites[id].image == NULL) {
+            sprites[id].image = image;
+            sprites[id].key = key;
+            sprites[id].visible = 0;
+            sprites[id].save = sprites[id].buffers[0];
+            sprites[id].spare = sprites[id].buffers[1];
+            return id;
+        }
+    }
+    return -1;
+}
+
+
+/*
+    Hide the sprite (if shown) and release its slot.
+*/
+void sprite_destroy(int id) {
+    sprite_hide(id);
+    sprites[id].image = NULL;
+}
+
+
+/*
+    Save what is under the sprite at (X,Y) and draw it there.
+*/
+void sprite_show(int id, int x, int y) {
+    sprite_t *s = &sprites[id];
+    if (s->visible) {
+        sprite_move(id, x, y);
+        return;
+    }
+    s->x = x;
+    s->y = y;
+    s->visible = 1;
+    sprite_composite(s, 0, 0, 0, 1, x, y);
+}
+
+
+/*
+    Put back the pixels the sprite was covering.
+*/
+void sprite_hide(int id) {
+    sprite_t *s = &sprites[id];
+    if (!s->visible) { return; }
+    sprite_composite(s, 1, s->x, s->y, 0, s->x, s->y);
+    s->visible = 0;
+}
+
+
+/*
+    Move a visible sprite to (X,Y) in a single restore-and-draw pass.
+*/
+void sprite_move(int id, int x, int y) {
+    sprite_t *s = &sprites[id];
+    if (!s->visible) {
+        sprite_show(id, x, y);
+        return;
+    }
+    if (x == s->x && y == s->y) { return; }
+    sprite_composite(s, 1, s->x, s->y, 1, x, y);
+    s->x = x;
+    s->y = y;
+}
+
+
+/*
+    Restore the old rectangle at (OX,OY) (if HAD_OLD) and save under and
+    draw the new one at (NX,NY) (if DRAW_NEW). Rectangles that overlap are
+    done together, row by row; apart, the old one is restored and then the
+    new one drawn. The new save buffer is the spare one; the two are
+    swapped afterwards.
+*/
+void sprite_composite(sprite_t *s, int had_old, int ox, int oy, int draw_new, int nx, int ny) {
+    int w = s->image->width, h = s->image->height;
+    color_t *tmp;
+
+    TRACE_CALL(TRACE_UNTRACED, 1, (long)UNTRACED_SPRITE);
+    if (had_old && draw_new && ox < nx + w && nx < ox + w && oy < ny + h && ny < oy + h) {
+        sprite_rows(s, 1, ox, oy, 1, nx, ny, (oy < ny) ? oy : ny, ((oy > ny) ? oy : ny) + h);
+    } else {
+        if (had_old) { sprite_rows(s, 1, ox, oy, 0, nx, ny, oy, oy + h); }
+        if (draw_new) { sprite_rows(s, 0, ox, oy, 1, nx, ny, ny, ny + h); }
+    }
+
+    if (draw_new) {
+        tmp = s->save;                                              // spare now holds the new save-under
+        s->save = s->spare;
+        s->spare = tmp;
+    }
+}
+
+
+/*
+    Display rows Y0..Y1-1 of sprite_composite(), clipped to the display.
+    On each row only the pixels of the old and new rectangles are touched:
+
+        new row part:  background (old save buffer where the old sprite was,
+                       else the display) into the spare buffer
+        old-only part: copied back from the old save buffer
+        new row part:  sprite pixels drawn, transparent ones from the background
+*/
+void sprite_rows(sprite_t *s, int had_old, int ox, int oy, int draw_new, int nx, int ny, int y0, int y1) {
+    const color_t *img = s->image->pixels;
+    int w = s->image->width, h = s->image->height, stride = s->image->stride;
+    int y, x, lo, hi, ilo, ihi, in_old, in_new, at_new, at_old, at_img;
+    color_t *dst, c;
+
+    if (y0 < 0) { y0 = 0; }
+    if (y1 > res_height) { y1 = res_height; }
+
+    for (y=y0; y<y1; y++) {
+        dst = display_addr + (y * res_width);
+        in_old = had_old && y >= oy && y < oy + h;
+        in_new = draw_new && y >= ny && y < ny + h;
+        at_new = ((y - ny) * w) - nx;                               // buffer offsets of display column 0
+        at_old = ((y - oy) * w) - ox;
+        at_img = ((y - ny) * stride) - nx;
+
+        lo = (nx < 0) ? 0 : nx;                                     // new sprite's pixels on this row
+        hi = (nx + w > res_width) ? res_width : nx + w;
+        if (in_new && lo < hi) {
+            ilo = hi;                                               // [ilo, ihi): also under the old sprite
+            ihi = hi;
+            if (in_old) {
+                ilo = (ox > nx) ? ox : nx;
+                ihi = ((ox < nx) ? ox : nx) + w;
+                if (ilo < lo) { ilo = lo; }
+                if (ilo > hi) { ilo = hi; }
+                if (ihi > hi) { ihi = hi; }
+                if (ihi < ilo) { ihi = ilo; }
+            }
+            if (ilo > lo) { kernels.copy(s->spare + at_new + lo, dst + lo, ilo - lo); }
+            if (ihi > ilo) { kernels.copy(s->spare + at_new + ilo, s->save + at_old + ilo, ihi - ilo); }
+            if (hi > ihi) { kernels.copy(s->spare + at_new + ihi, dst + ihi, hi - ihi); }
+        }
+
+        if (in_old) {                                               // old pixels the new sprite does not cover
+            ilo = (ox < 0) ? 0 : ox;
+            ihi = (ox + w > res_width) ? res_width : ox + w;
+            if (!in_new || nx >= ihi || nx + w <= ilo) {            // new sprite misses this row part: one run
+                if (ihi > ilo) { kernels.copy(dst + ilo, s->save + at_old + ilo, ihi - ilo); }
+            } else {
+                if (nx > ilo) { kernels.copy(dst + ilo, s->save + at_old + ilo, nx - ilo); }
+                if (ihi > nx + w) { kernels.copy(dst + nx + w, s->save + at_old + nx + w, ihi - nx - w); }
+            }
+        }
+
+        if (in_new && lo < hi) {
+            for (x=lo; x<hi; x++) {
+                c = img[at_img + x];
+                dst[x] = (c == s->key) ? s->spare[at_new + x] : c;
+            }
+        }
+    }
+}
+
+
+/*
+    Pixel kernels with runtime CPU dispatch.
+
+    The innermost loops (solid span fill, span copy, alpha blend, glyph
+    expansion, 0xRRGGBB -> RGB565 conversion, the nearest and bilinear rows
+    of draw_bitmap_affine(), and fill_span()'s gradient and pattern runs)
+    are built several times: a scalar reference here, and SIMD variants
+    from kernels.h for SSE2, AVX2 and AVX-512 (x86_64) or NEON (aarch64).
+    kernels_init() picks the best one the CPU and OS support, once, from
+    cpuid/xgetbv or AT_HWCAP, and everything calls through the kernels
+    table afterwards.
+
+    kernels_select(NAME) forces a variant ("scalar", "sse2", "avx2",
+    "avx512", "neon"); once forced, kernels_init() leaves it alone. Every
+    variant must give exactly the same pixels as the scalar one;
+    bench_kernels.c times them and checks that they do.
+*/
+unsigned short glyph_masks[256][8] __attribute__((aligned(16)));   // byte of glyph bits -> 8 lane masks
+
+
+void kernel_fill_scalar(color_t *dst, color_t c, int n) {
+    while (n-- > 0) { *dst++ = c; }
+}
+
+void kernel_copy_scalar(color_t *dst, const color_t *src, int n) {
+    while (n-- > 0) { *dst++ = *src++; }
+}
+
+/*
+    dst = (src * ALPHA + dst * (32 - ALPHA)) / 32 per channel, ALPHA 0..32.
+*/
+void kernel_blend_scalar(color_t *dst, const color_t *src, int alpha, int n) {
+    int s, d, ia = 32 - alpha;
+    while (n-- > 0) {
+        s = *src++;
+        d = *dst;
+        *dst++ = (color_t)(((((s >> 11) * alpha + (d >> 11) * ia) >> 5) << 11) |
+                           (((((s >> 5) & 63) * alpha + ((d >> 5) & 63) * ia) >> 5) << 5) |
+                           (((s & 31) * alpha + (d & 31) * ia) >> 5));
+    }
+}
+
+/*
+    Write C into each of the WIDTH pixels whose bit is set in BITS (bit 0 =
+    leftmost pixel, the iso_font.h order); clear bits leave the pixel alone.
+*/
+void kernel_glyph_scalar(color_t *dst, unsigned int bits, int width, color_t c) {
+    int col;
+    for (col=0; col<width; col++) {
+        if ((bits >> col) & 1) { dst[col] = c; }
+    }
+}
+
+void kernel_convert_scalar(color_t *dst, const unsigned int *src, int n) {
+    unsigned int p;
+    while (n-- > 0) {
+        p = *src++;
+        *dst++ = (color_t)(((p >> 8) & 0xF800) | ((p >> 5) & 0x07E0) | ((p >> 3) & 0x001F));
+    }
+}
+
+/*
+    Gradient colors for N pixels from their 16.16 parameters T (0 = F->from,
+    1.0 = F->to), ordered-dithered for display row Y starting at column X.
+*/
+void kernel_gradient_scalar(color_t *dst, const fill_t *f, const int *t, int x, int y, int n) {
+    int i;
+    for (i=0; i<n; i++) { dst[i] = gradient_color(f, t[i], x + i, y); }
+}
+
+/*
+    8-pixel repeating pattern: pixel I gets SET when bit (I & 7) of BITS is
+    set, CLEAR otherwise.
+*/
+void kernel_pattern_scalar(color_t *dst, unsigned int bits, color_t set, color_t clear, int n) {
+    int i;
+    for (i=0; i<n; i++) { dst[i] = ((bits >> (i & 7)) & 1) ? set : clear; }
+}
+
+
+#if defined(__x86_64__)
+#define KERNEL_SUFFIX sse2
+#define KERNEL_TARGET __attribute__((target("sse2")))
+#define KERNEL_VBYTES 16
+#include "kernels.h"
+#undef KERNEL_SUFFIX
+#undef KERNEL_TARGET
+#undef KERNEL_VBYTES
+
+#define KERNEL_SUFFIX avx2
+#define KERNEL_TARGET __attribute__((target("avx2")))
+#define KERNEL_VBYTES 32
+#include "kernels.h"
+#undef KERNEL_SUFFIX
+#undef KERNEL_TARGET
+#undef KERNEL_VBYTES
+
+#define KERNEL_SUFFIX avx512
+#define KERNEL_TARGET __attribute__((target("avx512f,avx512bw")))
+#define KERNEL_VBYTES 64
+#include "kernels.h"
+#undef KERNEL_SUFFIX
+#undef KERNEL_TARGET
+#undef KERNEL_VBYTES
+#elif defined(__aarch64__)
+#define KERNEL_SUFFIX neon
+#define KERNEL_TARGET                       // Advanced SIMD is part of the AArch64 baseline
+#define KERNEL_VBYTES 16
+#include "kernels.h"
+#undef KERNEL_SUFFIX
+#undef KERNEL_TARGET
+#undef KERNEL_VBYTES
+#endif
+
+#define KERNEL_VARIANT(name) { #name, kernel_fill_##name, kernel_copy_##name, kernel_blend_##name, kernel_glyph_##name, \
+                              kernel_convert_##name, kernel_nearest_##name, kernel_bilinear_##name, \
+                              kernel_gradient_##name, kernel_pattern_##name }
+
+const kernels_t kernel_variants[] = {      // worst to best; kernels_init() takes the last one supported
+    KERNEL_VARIANT(scalar),
+#if defined(__x86_64__)
+    KERNEL_VARIANT(sse2),
+    KERNEL_VARIANT(avx2),
+    KERNEL_VARIANT(avx512),
+#elif defined(__aarch64__)
+    KERNEL_VARIANT(neon),
+#endif
+};
+
+#define KERNEL_VARIANTS ((int)(sizeof(kernel_variants) / sizeof(kernel_variants[0])))
+
+kernels_t kernels = KERNEL_VARIANT(scalar);    // active variant
+int kernels_forced;                             // set by kernels_select()
+
+
+/*
+    Whether this CPU (and OS) can run variant NAME.
+
+    x86_64: SSE2 is always there. AVX2 needs cpuid leaf 7 EBX bit 5 and the
+    OS saving YMM state (OSXSAVE, XCR0 bits 1-2). AVX-512 needs AVX512F and
+    AVX512BW (leaf 7 EBX bits 16 and 30) and ZMM/opmask state (XCR0 bits 5-7).
+    aarch64: NEON is AT_HWCAP bit 1 (HWCAP_ASIMD).
+*/
+int kernel_supported(const char *name) {
+#if defined(__x86_64__)
+    unsigned int a, b, c, d, xcr0_lo, xcr0_hi;
+#endif
+
+    if (kernel_name_is(name, "scalar")) { return 1; }
+#if defined(__x86_64__)
+    if (kernel_name_is(name, "sse2")) { return 1; }
+
+    __asm__ volatile ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(0), "c"(0));
+    if (a < 7) { return 0; }                                    // no leaf 7: nothing newer than SSE
+    __asm__ volatile ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1), "c"(0));
+    if (!(c & (1u << 27))) { return 0; }                        // OSXSAVE: OS manages extended state
+    __asm__ volatile ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    __asm__ volatile ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(7), "c"(0));
+
+    if (kernel_name_is(name, "avx2")) {
+        return (b & (1u << 5)) && (xcr0_lo & 0x06) == 0x06;
+    }
+    if (kernel_name_is(name, "avx512")) {
+        return (b & (1u << 16)) && (b & (1u << 30)) && (xcr0_lo & 0xE6) == 0xE6;
+    }
+#elif defined(__aarch64__)
+    if (kernel_name_is(name, "neon")) { return (getauxval(AT_HWCAP) >> 1) & 1; }
+#endif
+    return 0;
+}
+
+
+int kernel_name_is(const char *a, const char *b) {
+    while (*a && *a == *b) { a++; b++; }
+    return *a == *b;
+}
+
+
+/*
+    Build glyph_masks[]: lane I of entry B is 0xFFFF when bit I of B is set.
+*/
+void kernel_glyph_masks() {
+    int b, i;
+    for (b=0; b<256; b++) {
+        for (i=0; i<8; i++) { glyph_masks[b][i] = ((b >> i) & 1) ? 0xFFFF : 0; }
+    }
+}
+
+
+/*
+    Force variant NAME. Returns 0, or -1 (leaving the active variant alone)
+    if it is unknown or this CPU cannot run it.
+*/
+int kernels_select(const char *name) {
+    int i;
+    for (i=0; i<KERNEL_VARIANTS; i++) {
+        if (kernel_name_is(kernel_variants[i].name, name) && kernel_supported(name)) {
+            kernel_glyph_masks();
+            kernels = kernel_variants[i];
+            kernels_forced = 1;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+/*
+    Pick the best supported variant, unless kernels_select() already chose
+    one. Called when the first display is opened (display_slot()).
+*/
+void kernels_init() {
+    int i;
+    if (kernels_forced) { return; }
+    kernel_glyph_masks();
+    for (i=KERNEL_VARIANTS-1; i>0; i--) {
+        if (kernel_supported(kernel_variants[i].name)) { break; }
+    }
+    kernels = kernel_variants[i];
+}
+
+
+/*
+    Copy the bitmap to the display with its upper-left corner at (X,Y),
+    clipped to the display.
+*/
+void draw_bitmap(int x, int y, const bitmap_t *src) {
+    draw_bitmap_alpha(x, y, src, 255);
+}
+
+
+/*
+    Blend the bitmap onto the display at (X,Y) with constant opacity
+    ALPHA (0 = invisible, 255 = opaque), clipped to the display.
+*/
+void draw_bitmap_alpha(int x, int y, const bitmap_t *src, int alpha) {
+    int sx = 0, sy = 0, w = src->width, h = src->height, row;
+    int a = (alpha * 32 + 127) / 255;                           // 0..255 -> 0..32
+
+    TRACE_CALL(TRACE_UNTRACED, 1, (long)UNTRACED_BITMAP);
+
+    if (x < 0) { sx = -x; w += x; x = 0; }
+    if (y < 0) { sy = -y; h += y; y = 0; }
+    if (x + w > res_width) { w = res_width - x; }
+    if (y + h > res_height) { h = res_height - y; }
+    if (w <= 0 || h <= 0 || a <= 0) { return; }
+
+    for (row=0; row<h; row++) {
+        if (a >= 32) {
+            kernels.copy(display_addr + ((y + row) * res_width) + x, src->pixels + ((sy + row) * src->stride) + sx, w);
+        } else {
+            kernels.blend(display_addr + ((y + row) * res_width) + x, src->pixels + ((sy + row) * src->stride) + sx, a, w);
+        }
+    }
+}
+
+
+/*
+    Convert N 0xRRGGBB pixels to RGB565, e.g. to build a bitmap_t from
+    24-bit image data.
+*/
+void convert_rgb888(color_t *dst, const unsigned int *src, int n) {
+    kernels.convert(dst, src, n);
+}
+
+
+/*
+    Loadable PSF console fonts (the format of /usr/share/consolefonts; those
+    ship gzipped, so gunzip them first).
+
+    font_load() mmaps the file read-only and points straight at the glyph
+    bitmaps inside it; nothing is copied. Glyphs may be any width and
+    height. If the font has a Unicode table it is turned into a lookup
+    (code points 0..255 direct, the rest sorted for a binary search);
+    otherwise code point N is glyph N.
+
+    Each font draws at an integer scale (font_scale()), which widens and
+    bit-reverses the rows of every glyph into the font's glyph cache, ready
+    for the glyph kernel, so drawing a glyph is just one kernel call per
+    output row. The cache is built whole rather than as glyphs are first
+    drawn so that drawing never writes to the font: once font_load() or
+    font_scale() has returned, a font_t is read-only and any number of
+    render threads (display_start()) may draw with it at once. Only
+    font_scale() and font_close() change it, and they must not run while
+    another thread is drawing with the same font.
+
+    Text is UTF-8. font_layout() and font_measure() only look at glyph
+    sizes, never at pixels, so text can be laid out cheaply before (or
+    instead of) drawing it.
+
+        PSF1:  36 04 [mode] [height]  glyphs of 8 x height, 256 or 512 (mode & 1)
+               Unicode table if mode & 6: per glyph, u16 LE code points ending in FFFF
+        PSF2:  72 B5 4A 86 [version headersize flags length charsize height width] (u32 LE)
+               Unicode table if flags & 1: per glyph, UTF-8 code points ending in FF
+
+    https://www.win.tue.nl/~aeb/linux/kbd/font-formats-1.html
+*/
+#define PSF1_MODE512    0x01
+#define PSF1_MODEHASTAB 0x06
+#define PSF2_HAS_UNICODE_TABLE 0x01
+
+
+unsigned int read_u32le(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+
+/*
+    Decode one UTF-8 code point at *S and advance past it. Malformed bytes
+    come back as themselves, one at a time. The string must be
+    NUL-terminated (a NUL is never a continuation byte, so decoding stops
+    there); use utf8_next_n() for bytes that are not.
+*/
+int utf8_next(const char **s) {
+    return utf8_next_n(s, NULL);
+}
+
+
+/*
+    utf8_next() that never reads at or past END (unless END is NULL): a
+    sequence cut off by END is malformed, and its lead byte comes back
+    alone. *S must be below END.
+*/
+int utf8_next_n(const char **s, const char *end) {
+    const unsigned char *p = (const unsigned char *)*s;
+    int cp, extra, i;
+
+    if (p[0] < 0x80)      { cp = p[0];        extra = 0; }
+    else if (p[0] < 0xC0) { cp = p[0];        extra = -1; }
+    else if (p[0] < 0xE0) { cp = p[0] & 0x1F; extra = 1; }
+    else if (p[0] < 0xF0) { cp = p[0] & 0x0F; extra = 2; }
+    else                  { cp = p[0] & 0x07; extra = 3; }
+    if (end && extra > end - *s - 1) { extra = -1; }            // truncated by END
+
+    for (i=1; i<=extra; i++) {
+        if ((p[i] & 0xC0) != 0x80) { extra = -1; break; }
+        cp = (cp << 6) | (p[i] & 0x3F);
+    }
+    if (extra < 0) {
+        *s += 1;
+        return p[0];
+    }
+    *s += extra + 1;
+    return cp;
+}
+
+
+/*
+    Record that code point CP is drawn with GLYPH (first mapping wins).
+*/
+void font_map_add(font_t *f, int cp, int glyph) {
+    if (cp < 256) {
+        if (f->latin1[cp] == FONT_NO_GLYPH) { f->latin1[cp] = glyph; }
+    } else if (f->map_count < FONT_MAX_MAP) {
+        f->unicode[f->map_count].cp = cp;
+        f->unicode[f->map_count].glyph = glyph;
+        f->map_count++;
+    }
+}
+
+
+/*
+    Build the code point lookup from the font's Unicode table, which starts
+    at TABLE and runs to the end of the file.
+*/
+void font_read_unicode(font_t *f, const unsigned char *table, int psf2) {
+    const unsigned char *p = table, *end = f->map + f->map_size;
+    const char *s;
+    int glyph, cp, i, j, in_sequence;
+    font_map_t m;
+
+    for (i=0; i<256; i++) { f->latin1[i] = FONT_NO_GLYPH; }
+
+    for (glyph=0; glyph<f->count && p<end; glyph++) {
+        in_sequence = 0;                                        // combining sequences are skipped
+        if (psf2) {
+            while (p < end && *p != 0xFF) {
+                if (*p == 0xFE) { in_sequence = 1; p++; continue; }
+                s = (const char *)p;
+                cp = utf8_next_n(&s, (const char *)end);
+                p = (const unsigned char *)s;
+                if (!in_sequence) { font_map_add(f, cp, glyph); }
+            }
+            p++;
+        } else {
+            while (p + 1 < end && (cp = p[0] | (p[1] << 8)) != 0xFFFF) {
+                if (cp == 0xFFFE) { in_sequence = 1; }
+                else if (!in_sequence) { font_map_add(f, cp, glyph); }
+                p += 2;
+            }
+            p += 2;
+        }
+    }
+
+    for (i=1; i<f->map_count; i++) {                            // insertion sort by code point
+        m = f->unicode[i];
+        for (j=i; j>0 && f->unicode[j-1].cp > m.cp; j--) { f->unicode[j] = f->unicode[j-1]; }
+        f->unicode[j] = m;
+    }
+}
+
+
+/*
+    Map the PSF1 or PSF2 font at PATH into F. Returns 0, or -1 if the file
+    cannot be read or is not a PSF font. The font draws at scale 1 until
+    font_scale() says otherwise.
+*/
+int font_load(font_t *f, const char *path) {
+    const unsigned char *p, *table = NULL;
+    unsigned long header_size, count, glyph_bytes, width, height;
+    int fd, i, psf2 = 0;
+    long size;
+
+    f->map = NULL;
+    f->cache = NULL;
+    f->map_count = 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) { return -1; }
+    size = lseek(fd, 0, SEEK_END);
+    if (size < 4) { close(fd); return -1; }
+    p = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);                                                  // the mapping keeps the file alive
+    if (p == MAP_FAILED) { return -1; }
+    f->map = p;
+    f->map_size = size;
+
+    if (p[0] == 0x36 && p[1] == 0x04) {                         // PSF1
+        f->count = (p[2] & PSF1_MODE512) ? 512 : 256;
+        f->width = 8;
+        f->height = p[3];
+        f->row_bytes = 1;
+        f->glyph_bytes = p[3];
+        f->glyphs = p + 4;
+        if (p[2] & PSF1_MODEHASTAB) { table = f->glyphs + f->count * f->glyph_bytes; }
+    } else if (size >= 32 && read_u32le(p) == 0x864AB572) {     // PSF2
+        psf2 = 1;
+        header_size = read_u32le(p + 8);
+        count = read_u32le(p + 16);
+        glyph_bytes = read_u32le(p + 20);
+        height = read_u32le(p + 24);
+        width = read_u32le(p + 28);
+        if (header_size < 32 || header_size > (unsigned long)size ||
+            count < 1 || count >= FONT_NO_GLYPH || width < 1 || width > FONT_MAX_CELL ||
+            height < 1 || height > FONT_MAX_CELL || glyph_bytes < ((width + 7) / 8) * height ||
+            glyph_bytes > (unsigned long)size) {
+            font_close(f);                                      // nonsense header, fields checked while still unsigned
+            return -1;
+        }
+        f->count = count;
+        f->glyph_bytes = glyph_bytes;
+        f->height = height;
+        f->width = width;
+        f->row_bytes = (f->width + 7) / 8;
+        f->glyphs = p + header_size;
+        if (read_u32le(p + 12) & PSF2_HAS_UNICODE_TABLE) { table = f->glyphs + (size_t)f->count * f->glyph_bytes; }
+    } else {
+        font_close(f);
+        return -1;
+    }
+
+    if (f->height <= 0 || (f->glyphs - p) + (unsigned long long)f->count * f->glyph_bytes > (unsigned long long)size) {
+        font_close(f);                                          // header promises more than the file holds
+        return -1;
+    }
+
+    if (table) {
+        font_read_unicode(f, table, psf2);
+    } else {
+        for (i=0; i<256; i++) { f->latin1[i] = (i < f->count) ? i : FONT_NO_GLYPH; }
+    }
+
+    if (font_scale(f, 1) < 0) {
+        font_close(f);
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+    Unmap the font and its glyph cache.
+*/
+void font_close(font_t *f) {
+    if (f->cache) { munmap(f->cache, f->cache_size); }
+    if (f->map) { munmap((void *)f->map, f->map_size); }
+    f->cache = NULL;
+    f->map = NULL;
+}
+
+
+/*
+    Draw the font at integer SCALE (each glyph pixel becomes SCALE x SCALE).
+    Builds a new glyph cache holding every glyph at that scale (PSF rows are
+    MSB-first, the glyph kernel wants bit 0 = leftmost pixel, and every
+    source pixel is repeated SCALE times across), then drops the old one.
+    Returns 0, or -1 if SCALE is above FONT_MAX_SCALE or the cache cannot
+    be mapped; the font then keeps its old scale.
+*/
+int font_scale(font_t *f, int scale) {
+    unsigned int *cache, *rows;
+    const unsigned char *src;
+    int words, glyph, row, col, bit, k;
+    size_t size;
+
+    if (scale < 1) { scale = 1; }
+    if (scale > FONT_MAX_SCALE) { return -1; }
+
+    words = (f->width * scale + 31) / 32;
+    size = (size_t)f->count * f->height * words * sizeof(unsigned int);
+    cache = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (cache == MAP_FAILED) { return -1; }
+
+    for (glyph=0; glyph<f->count; glyph++) {
+        for (row=0; row<f->height; row++) {
+            src = f->glyphs + (size_t)glyph * f->glyph_bytes + row * f->row_bytes;
+            rows = cache + ((size_t)glyph * f->height + row) * words;
+            for (col=0; col<f->width; col++) {
+                if (!((src[col >> 3] >> (7 - (col & 7))) & 1)) { continue; }
+                for (k=0; k<scale; k++) {
+                    bit = col * scale + k;
+                    rows[bit >> 5] |= 1u << (bit & 31);
+                }
+            }
+        }
+    }
+
+    if (f->cache) { munmap(f->cache, f->cache_size); }
+    f->cache = cache;
+    f->cache_size = size;
+    f->cache_words = words;
+    f->scale = scale;
+    return 0;
+}
+
+
+/*
+    Glyph index for code point CP, falling back to '?' and then glyph 0.
+*/
+int font_glyph(const font_t *f, int cp) {
+    int lo = 0, hi = f->map_count - 1, mid;
+
+    if (cp >= 0 && cp < 256) {
+        if (f->latin1[cp] != FONT_NO_GLYPH) { return f->latin1[cp]; }
+    } else {
+        while (lo <= hi) {
+            mid = (lo + hi) / 2;
+            if (f->unicode[mid].cp == cp) { return f->unicode[mid].glyph; }
+            if (f->unicode[mid].cp < cp) { lo = mid + 1; } else { hi = mid - 1; }
+        }
+    }
+    return (f->latin1['?'] != FONT_NO_GLYPH) ? f->latin1['?'] : 0;
+}
+
+
+/*
+    Cached rows of GLYPH at the current scale: HEIGHT rows of cache_words
+    words each, bit 0 = leftmost pixel. Only reads the font.
+*/
+const unsigned int *font_glyph_rows(const font_t *f, int glyph) {
+    return f->cache + (size_t)glyph * f->height * f->cache_words;
+}
+
+
+/*
+    Draw GLYPH with its upper-left corner at (X,Y), clipped to the display.
+*/
+void font_draw_glyph(const font_t *f, int x, int y, int glyph, color_t c) {
+    const unsigned int *rows = font_glyph_rows(f, glyph);
+    int w = f->width * f->scale, h = f->height * f->scale;
+    int row, word, col, px, py, n;
+    unsigned int bits;
+
+    TRACE_CALL(TRACE_UNTRACED, 1, (long)UNTRACED_FONT);
+    if (x >= res_width || y >= res_height || x + w <= 0 || y + h <= 0) { return; }
+
+    for (row=0; row<h; row++) {
+        py = y + row;
+        if (py < 0 || py >= res_height) { continue; }
+        for (word=0; word<f->cache_words; word++) {
+            bits = rows[((row / f->scale) * f->cache_words) + word];
+            if (!bits) { continue; }
+            px = x + word * 32;
+            n = (w - word * 32 < 32) ? w - word * 32 : 32;
+            if (px >= 0 && px + n <= res_width) {               // whole word on screen: glyph kernel
+                kernels.glyph(display_addr + (py * res_width) + px, bits, n, c);
+            } else {
+                for (col=0; col<n; col++) {                     // crosses an edge: clip per pixel
+                    if (((bits >> col) & 1) && px + col >= 0 && px + col < res_width) {
+                        display_addr[(py * res_width) + px + col] = c;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/*
+    Split TEXT into lines at '\n', and, when MAX_WIDTH > 0, wrap lines
+    wider than MAX_WIDTH pixels at the last space (or mid-word if there is
+    none). Fills at most MAX_LINES entries of LINES and returns the number
+    of lines the text needs, which may be more. Touches no pixels.
+*/
+int font_layout(const font_t *f, const char *text, int max_width, text_line_t *lines, int max_lines) {
+    int advance = f->width * f->scale;
+    int count = 0, start = 0, width = 0, space = -1, space_width = 0, pos = 0;
+    const char *p = text, *q;
+    int cp;
+
+    while (1) {
+        q = p;
+        cp = (*p == '\0') ? -1 : utf8_next(&p);
+
+        if (cp == -1 || cp == '\n') {                           // end of a line
+            if (count < max_lines) {
+                lines[count].start = start;
+                lines[count].length = pos - start;
+                lines[count].width = width;
+            }
+            count++;
+            if (cp == -1) { break; }
+            start = pos = p - text;
+            width = 0;
+            space = -1;
+            continue;
+        }
+
+        if (max_width > 0 && width + advance > max_width && width > 0) {
+            if (space >= 0) {                                   // wrap after the last space
+                if (count < max_lines) {
+                    lines[count].start = start;
+                    lines[count].length = space - start;
+                    lines[count].width = space_width;
+                }
+                width -= space_width + advance;                 // the space itself is dropped
+                start = space + 1;
+            } else {                                            // no space: break mid-word
+                if (count < max_lines) {
+                    lines[count].start = start;
+                    lines[count].length = pos - start;
+                    lines[count].width = width;
+                }
+                width = 0;
+                start = pos;
+            }
+            count++;
+            space = -1;
+        }
+
+        if (cp == ' ') {
+            space = q - text;
+            space_width = width;
+        }
+        width += advance;
+        pos = p - text;
+    }
+
+    return count;
+}
+
+
+/*
+    Size in pixels of TEXT drawn with font_draw_text() (no wrapping).
+*/
+void font_measure(const font_t *f, const char *text, int *width, int *height) {
+    int advance = f->width * f->scale, lines = 1, w = 0;
+    const char *p = text;
+
+    *width = 0;
+    while (*p) {
+        if (utf8_next(&p) == '\n') {
+            lines++;
+            w = 0;
+        } else {
+            w += advance;
+            if (w > *width) { *width = w; }
+        }
+    }
+    *height = lines * f->height * f->scale;
+}
+
+
+/*
+    Draw COUNT lines from font_layout(), one line height apart, starting
+    with the upper-left corner at (X,Y).
+*/
+void font_draw_lines(const font_t *f, int x, int y, const char *text, const text_line_t *lines, int count, color_t c) {
+    const char *p, *end;
+    int i, px;
+
+    TRACE_CALL(TRACE_UNTRACED, 1, (long)UNTRACED_FONT);
+    TRACE_MUTE(1);                              // the glyphs below are part of this call
+    for (i=0; i<count; i++, y += f->height * f->scale) {
+        p = text + lines[i].start;
+        end = p + lines[i].length;
+        for (px=x; p<end; px += f->width * f->scale) {
+            font_draw_glyph(f, px, y, font_glyph(f, utf8_next(&p)), c);
+        }
+    }
+    TRACE_MUTE(-1);
+}
+
+
+/*
+    Draw UTF-8 TEXT with the upper-left corner of the first glyph at (X,Y);
+    '\n' starts a new line under the first.
+*/
+void font_draw_text(const font_t *f, int x, int y, const char *text, color_t c) {
+    int px = x, cp;
+
+    TRACE_CALL(TRACE_UNTRACED, 1, (long)UNTRACED_FONT);
+    TRACE_MUTE(1);                              // the glyphs below are part of this call
+    while (*text) {
+        cp = utf8_next(&text);
+        if (cp == '\n') {
+            px = x;
+            y += f->height * f->scale;
+            continue;
+        }
+        font_draw_glyph(f, px, y, font_glyph(f, cp), c);
+        px += f->width * f->scale;
+    }
+    TRACE_MUTE(-1);
+}
+
+
+/*
+    Lazy absolute value function
+*/
+int abs(int value) {
+    if (value < 0) { value = -value; }
+    return value;
+}
+
+
+/*
+    The internal '%' C operator performs what is known as
+    a "remainder" operation; returning the positive, or
+    negative, remainder of the result.
+
+    When calculating where pixels should be drawn on the
+    screen, we only care about the positive remainder.
+    This is because we only want to draw within the legal
+    bounds of the display.
+
+    https://stackoverflow.com/a/42131603/5635772
+*/
+int modulo(int x, int N) {
+    return (x % N + N) %N;
+}
+
+
+/*
+    Clear the screen by writing ANSI ESCAPE code "\033[2J".
+    The screen is STDOUT aka FD=1
+
+    ssize_t write(int FD, const void *BUF, size_t COUNT);
+*/
+void clear_screen() {
+    write(1, "\033[2J", 8);
+}
+
+
+/*
+    Grabs the terminal settings and turns ICANON and ECHO flags
+    ON or OFF, depending on the input parameter "on".
+
+    struct termios {
+        tcflag_t c_iflag;       // input modes
         tcflag_t c_oflag;       // output modes
         tcflag_t c_cflag;       // control modes
         tcflag_t c_lflag;       // local modes  (*)
@@ -321,7 +2823,174 @@ void set_terminal_settings(int on) {
 */
 void sleep_ms(long ms) {
     struct timespec req;
+    TRACE_CALL(TRACE_FRAME, 1, ms);             // sleeping marks the end of a frame
     req.tv_sec = 0;                 // sleep for zero seconds
     req.tv_nsec = ms*1000000;       // convert milliseconds to nanoseconds
     nanosleep(&req, NULL);          // (NULL) says to not worry about interrupts
 }
+
+
+/*
+    API call tracing (compile with -DTRACE).
+
+    Every public drawing call, getkey() result and frame boundary (each
+    sleep_ms() or trace_frame()) is appended to an in-memory buffer as a
+    compact binary record and written out to TRACE_FILE whenever the buffer
+    fills, and at exit_graphics(). Calls made from inside another traced
+    call (draw_line() -> draw_pixel()) are muted so only what the program
+    itself asked for is recorded. replay.c plays a trace back headless.
+
+    File:    "GLTR" [version] then records
+    Record:  [op] [arguments as zigzag varints]
+
+        TRACE_INIT      width height
+        TRACE_PIXEL     x y color
+        TRACE_LINE      x1 y1 x2 y2 color
+        TRACE_CHAR      x y c color
+        TRACE_TEXT      x y color length [bytes]
+        TRACE_POLYLINE  count color x0 y0 [dx dy ...]      (points delta-encoded)
+        TRACE_LINES     count color x1 y1 x2 y2 [deltas ...]
+        TRACE_FILL_*    shape arguments, then [fill]
+        TRACE_KEY       key                                 (every getkey(), 0 when no key)
+        TRACE_FRAME     ms                                  (0 from trace_frame())
+        TRACE_UNTRACED  kind                                (UNTRACED_*)
+
+        fill = style color background from to x0 y0 x1 y1 [pattern: 8 bytes]
+
+    Calls that draw from pixel data the trace does not carry (bitmap
+    blits, sprites, PSF fonts, FILL_BITMAP tiles) and indexed-mode drawing
+    cannot be replayed. They still leave a TRACE_UNTRACED record (or, for
+    tiles, their real FILL_BITMAP style), so replay can say the final hash
+    is not comparable instead of quietly disagreeing. Palette changes are
+    not recorded; they never touch the framebuffer. Tracing assumes a
+    single drawing thread.
+*/
+#ifdef TRACE
+#define TRACE_BUFFER_SIZE 65536
+
+unsigned char trace_buf[TRACE_BUFFER_SIZE];
+int trace_len;                      // bytes waiting in trace_buf
+int trace_fd = -1;                  // open trace file, -1 when tracing is off
+
+
+/*
+    Start tracing into PATH (created or truncated). Returns 0, or -1 if the
+    file cannot be opened.
+*/
+int trace_open(const char *path) {
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (trace_fd < 0) { trace_fd = -1; return -1; }
+    trace_len = 0;
+    trace_mute = 0;
+    trace_byte('G'); trace_byte('L'); trace_byte('T'); trace_byte('R');
+    trace_byte(TRACE_VERSION);
+    return 0;
+}
+
+
+/*
+    Write out whatever is buffered.
+*/
+void trace_flush() {
+    int done = 0, n;
+    while (done < trace_len) {
+        n = write(trace_fd, trace_buf + done, trace_len - done);
+        if (n <= 0) { break; }
+        done += n;
+    }
+    trace_len = 0;
+}
+
+
+/*
+    Flush and stop tracing.
+*/
+void trace_close() {
+    if (trace_fd < 0) { return; }
+    trace_flush();
+    close(trace_fd);
+    trace_fd = -1;
+}
+
+
+void trace_byte(int b) {
+    if (trace_len == TRACE_BUFFER_SIZE) { trace_flush(); }
+    trace_buf[trace_len++] = (unsigned char)b;
+}
+
+
+/*
+    Zigzag varint: small magnitudes of either sign take one byte.
+*/
+void trace_int(long v) {
+    unsigned long z = ((unsigned long)v << 1) ^ (unsigned long)(v >> (8 * sizeof(long) - 1));
+    while (z >= 0x80) {
+        trace_byte((int)(z & 0x7F) | 0x80);
+        z >>= 7;
+    }
+    trace_byte((int)z);
+}
+
+
+/*
+    Record OP followed by its N integer arguments.
+*/
+void trace_call(int op, int n, ...) {
+    __builtin_va_list ap;
+    if (trace_fd < 0) { return; }
+    trace_byte(op);
+    __builtin_va_start(ap, n);
+    while (n--) { trace_int(__builtin_va_arg(ap, long)); }
+    __builtin_va_end(ap);
+}
+
+
+/*
+    Record OP with COUNT points (PER coordinates each: 2 for a point, 4 for
+    a segment), each coordinate delta-encoded from the same one before.
+*/
+void trace_points(int op, const int *coords, int count, int per, color_t c) {
+    int i;
+    if (trace_fd < 0) { return; }
+    trace_byte(op);
+    trace_int(count);
+    trace_int(c);
+    for (i=0; i<count*per; i++) {
+        trace_int(i < per ? coords[i] : coords[i] - coords[i-per]);
+    }
+}
+
+
+void trace_text(int x, int y, const char *text, color_t c) {
+    int len = 0;
+    if (trace_fd < 0) { return; }
+    while (text[len] != '\0') { len++; }
+    trace_call(TRACE_TEXT, 4, (long)x, (long)y, (long)c, (long)len);
+    while (len--) { trace_byte(*text++); }
+}
+
+
+void trace_fill(const fill_t *f) {
+    int i;
+    if (trace_fd < 0) { return; }
+    trace_int(f->style);
+    trace_int(f->color);
+    trace_int(f->background);
+    trace_int(f->from);
+    trace_int(f->to);
+    trace_int(f->x0);
+    trace_int(f->y0);
+    trace_int(f->x1);
+    trace_int(f->y1);
+    for (i=0; i<8; i++) { trace_byte(f->pattern[i]); }
+}
+#endif
+
+
+/*
+    Mark the end of a frame for programs that do not sleep_ms() between
+    frames. Does nothing unless built with -DTRACE.
+*/
+void trace_frame() {
+    TRACE_CALL(TRACE_FRAME, 1, 0L);
+}
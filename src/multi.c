@@ -0,0 +1,110 @@
+#include "library.c"
+#include "bench.h"
+
+/*
+    Multi-display driver
+
+    Opens every framebuffer (/dev/fb0 .. /dev/fb7) and gives each one its
+    own render thread pinned to its own CPU. With no framebuffers, or when
+    run as "multi -fake", two file-backed displays of different sizes are
+    created instead (/tmp/fakefb0 640x480 and /tmp/fakefb1 320x240) so the
+    output can be inspected afterwards.
+
+    Once every thread has finished, each display is checked against its
+    last frame drawn again by the main thread into private memory, and a
+    fake display's file must also hold exactly its WIDTH x HEIGHT pixels.
+    A thread that drew with another display's geometry or into another
+    display's memory shows up as a mismatch, and multi exits with status 1.
+
+        gcc -O2 -pthread -o multi multi.c && ./multi -fake
+*/
+
+#define FRAMES 60
+
+/*
+    Every display draws the same scene scaled to its own geometry: a
+    gradient background, a border and a label. iso_font[] and the fill
+    style are shared read-only by all threads.
+*/
+void draw_frame(int id, int frame, const fill_t *background) {
+    char label[] = "DISPLAY N";
+
+    label[8] = '0' + id;
+    fill_rect(0, 0, res_width, res_height, background);
+    draw_line(0, 0, res_width-1, 0, 0xFFFF);
+    draw_line(res_width-1, 0, res_width-1, res_height-1, 0xFFFF);
+    draw_line(res_width-1, res_height-1, 0, res_height-1, 0xFFFF);
+    draw_line(0, res_height-1, 0, 0, 0xFFFF);
+    draw_text(10 + frame, res_height/2, label, 0xFFFF);
+}
+
+void render(int id, void *arg) {
+    int frame;
+    for (frame=0; frame<FRAMES; frame++) {
+        draw_frame(id, frame, arg);
+        sleep_ms(16);
+    }
+}
+
+
+/*
+    Compare display ID with its last frame redrawn in private memory.
+    Returns 1 if they match.
+*/
+int check(int id, const fill_t *background) {
+    display_t *d = &displays[id];
+    color_t *expect;
+    size_t pixels, i;
+    int ok = 1;
+
+    display_select(id);
+    pixels = (size_t)res_width * res_height;
+    if (d->fake && lseek(d->fd, 0, SEEK_END) != (off_t)(pixels * sizeof(color_t))) {
+        ok = 0;                                                 // file is not WIDTH x HEIGHT RGB565
+    }
+
+    expect = mmap(0, pixels * sizeof(color_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    display_addr = expect;                                      // same geometry, private buffer
+    draw_frame(id, FRAMES - 1, background);
+    for (i=0; i<pixels && ok; i++) {
+        if (d->addr[i] != expect[i]) { ok = 0; }
+    }
+    munmap(expect, pixels * sizeof(color_t));
+
+    print_str("display ");
+    print_num(id);
+    print_str(": ");
+    print_num(res_width);
+    print_str("x");
+    print_num(res_height);
+    print_str(ok ? " ok\n" : " MISMATCH\n");
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    fill_t background = {0};
+    int id, count = 0, failures = 0;
+
+    background.style = FILL_LINEAR;
+    background.from = 0x000040;
+    background.to = 0x0080FF;
+    background.x1 = 0;
+    background.y1 = 480;
+
+    if (argc < 2 || argv[1][0] != '-') { count = display_enumerate(); }
+    if (count == 0) {
+        if (display_open_fake("/tmp/fakefb0", 640, 480) < 0 || display_open_fake("/tmp/fakefb1", 320, 240) < 0) {
+            print_str("cannot create the fake displays in /tmp\n");
+            display_close(0);                                   // the first may have opened
+            return 1;
+        }
+        count = 2;
+    }
+
+    for (id=0; id<count; id++) { display_start(id, id, render, &background); }
+    for (id=0; id<count; id++) { display_join(id); }
+    for (id=0; id<count; id++) { failures += !check(id, &background); }
+    for (id=0; id<count; id++) { display_close(id); }
+
+    return failures ? 1 : 0;
+}
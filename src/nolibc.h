@@ -0,0 +1,329 @@
+#include <linux/auxvec.h>      /* AT_SYSINFO_EHDR */
+#include <linux/elf.h>          /* Elf64_Ehdr Elf64_Phdr Elf64_Dyn Elf64_Sym */
+#include <linux/fb.h>           /* FB_VAR_SCREENINFO FB_FIX_SCREENINFO */
+#include <linux/time.h>         /* struct timespec struct timeval */
+#include <asm/fcntl.h>          /* O_RDWR */
+#include <asm/ioctls.h>         /* TCGETS TCSETS */
+#include <linux/mman.h>         /* PROT_READ PROT_WRITE MAP_SHARED */
+#include <asm/signal.h>         /* SIGCHLD */
+#include <asm/termbits.h>       /* struct termios ICANON ECHO */
+#include <asm/unistd.h>         /* __NR_* syscall numbers */
+
+/*
+    Freestanding Runtime (no C standard library)
+
+    Compile with -DNOLIBC and library.c will include this file instead of the
+    libc headers. Everything library.c used from libc (open, ioctl, mmap,
+    select, read, write, nanosleep, lseek, ftruncate) is provided here as a
+    thin wrapper around the raw syscall instruction, along with a minimal
+    _start entry point and a vDSO lookup so clock_gettime() never enters the
+    kernel.
+
+        gcc -DNOLIBC -O2 -static -nostdlib -ffreestanding -fno-builtin \
+            -fno-stack-protector -fno-asynchronous-unwind-tables \
+            -o square square.c -lgcc
+
+    Only the kernel's own UAPI headers are used, so the types and constants
+    match what the kernel expects byte for byte. Wrappers return the raw
+    kernel result: a negative value is -errno (there is no errno variable).
+
+    REFERENCES
+    ----------
+    SYSCALL ABI:    https://man7.org/linux/man-pages/man2/syscall.2.html
+    VDSO:           https://man7.org/linux/man-pages/man7/vdso.7.html
+    PARSE_VDSO:     https://github.com/torvalds/linux/blob/master/tools/testing/selftests/vDSO/parse_vdso.c
+*/
+
+#if !defined(__x86_64__) && !defined(__aarch64__)
+#error "NOLIBC runtime only supports x86_64 and aarch64"
+#endif
+
+#define NULL ((void *)0)
+#define AT_FDCWD -100               // openat() relative to the current directory
+#define SEEK_SET 0                  // lseek() whence
+#define SEEK_END 2
+
+typedef __SIZE_TYPE__ size_t;
+typedef long ssize_t;
+typedef long off_t;
+
+/*
+    select() works on a bitmap of file descriptors; only the first word is
+    ever used by this library (STDIN), but keep the kernel's 1024-bit size.
+*/
+typedef struct { unsigned long fds_bits[1024 / (8 * sizeof(unsigned long))]; } fd_set;
+
+#define FD_ZERO(set) do { int _i; for (_i=0; _i<(int)(sizeof((set)->fds_bits)/sizeof(unsigned long)); _i++) (set)->fds_bits[_i] = 0; } while (0)
+#define FD_SET(fd, set) ((set)->fds_bits[(fd) / (8 * sizeof(unsigned long))] |= 1UL << ((fd) % (8 * sizeof(unsigned long))))
+#define FD_ISSET(fd, set) (((set)->fds_bits[(fd) / (8 * sizeof(unsigned long))] >> ((fd) % (8 * sizeof(unsigned long)))) & 1)
+
+
+/*
+    Raw syscall entry. Every wrapper below funnels through this one function.
+
+    x86_64:   number in RAX, arguments in RDI RSI RDX R10 R8 R9, "syscall"
+              clobbers RCX and R11.
+    aarch64:  number in X8, arguments in X0-X5, "svc #0", result in X0.
+*/
+static inline long __syscall6(long n, long a1, long a2, long a3, long a4, long a5, long a6) {
+#if defined(__x86_64__)
+    long ret;
+    register long r10 __asm__("r10") = a4;
+    register long r8 __asm__("r8") = a5;
+    register long r9 __asm__("r9") = a6;
+    __asm__ volatile ("syscall"
+                      : "=a"(ret)
+                      : "a"(n), "D"(a1), "S"(a2), "d"(a3), "r"(r10), "r"(r8), "r"(r9)
+                      : "rcx", "r11", "memory");
+    return ret;
+#else
+    register long x8 __asm__("x8") = n;
+    register long x0 __asm__("x0") = a1;
+    register long x1 __asm__("x1") = a2;
+    register long x2 __asm__("x2") = a3;
+    register long x3 __asm__("x3") = a4;
+    register long x4 __asm__("x4") = a5;
+    register long x5 __asm__("x5") = a6;
+    __asm__ volatile ("svc #0"
+                      : "+r"(x0)
+                      : "r"(x8), "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x5)
+                      : "memory", "cc");
+    return x0;
+#endif
+}
+
+#define __syscall0(n)               __syscall6((n), 0, 0, 0, 0, 0, 0)
+#define __syscall1(n, a)            __syscall6((n), (long)(a), 0, 0, 0, 0, 0)
+#define __syscall2(n, a, b)         __syscall6((n), (long)(a), (long)(b), 0, 0, 0, 0)
+#define __syscall3(n, a, b, c)      __syscall6((n), (long)(a), (long)(b), (long)(c), 0, 0, 0)
+#define __syscall4(n, a, b, c, d)   __syscall6((n), (long)(a), (long)(b), (long)(c), (long)(d), 0, 0)
+
+
+/*
+    libc-compatible wrappers. aarch64 has no open(), select() or fork(), so
+    the *at()/pselect6()/clone() forms are used on both architectures.
+*/
+static inline int open(const char *path, int flags, ...) {
+    __builtin_va_list ap;
+    int mode;
+    __builtin_va_start(ap, flags);
+    mode = (flags & O_CREAT) ? __builtin_va_arg(ap, int) : 0;   // mode only comes with O_CREAT
+    __builtin_va_end(ap);
+    return __syscall4(__NR_openat, AT_FDCWD, path, flags, mode);
+}
+
+static inline int close(int fd) {
+    return __syscall1(__NR_close, fd);
+}
+
+static inline ssize_t read(int fd, void *buf, size_t count) {
+    return __syscall3(__NR_read, fd, buf, count);
+}
+
+static inline ssize_t write(int fd, const void *buf, size_t count) {
+    return __syscall3(__NR_write, fd, buf, count);
+}
+
+static inline int ioctl(int fd, unsigned long request, void *arg) {
+    return __syscall3(__NR_ioctl, fd, request, arg);
+}
+
+#define MAP_FAILED ((void *)-1)
+
+static inline void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    long r = __syscall6(__NR_mmap, (long)addr, length, prot, flags, fd, offset);
+    return (r < 0 && r > -4096) ? MAP_FAILED : (void *)r;      // -errno, as libc reports it
+}
+
+static inline int munmap(void *addr, size_t length) {
+    return __syscall2(__NR_munmap, addr, length);
+}
+
+static inline off_t lseek(int fd, off_t offset, int whence) {
+    return __syscall3(__NR_lseek, fd, offset, whence);
+}
+
+static inline int ftruncate(int fd, off_t length) {
+    return __syscall2(__NR_ftruncate, fd, length);
+}
+
+static inline int nanosleep(const struct timespec *req, struct timespec *rem) {
+    return __syscall2(__NR_nanosleep, req, rem);
+}
+
+/*
+    select() on top of pselect6(); the timeval is converted to a timespec
+    and no signal mask is passed.
+*/
+static inline int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+    struct timespec ts, *tsp = NULL;
+    if (timeout) {
+        ts.tv_sec = timeout->tv_sec;
+        ts.tv_nsec = timeout->tv_usec * 1000;
+        tsp = &ts;
+    }
+    return __syscall6(__NR_pselect6, nfds, (long)readfds, (long)writefds, (long)exceptfds, (long)tsp, 0);
+}
+
+static inline int fork() {
+    return __syscall2(__NR_clone, SIGCHLD, 0);
+}
+
+static inline int execve(const char *path, char *const argv[], char *const envp[]) {
+    return __syscall3(__NR_execve, path, argv, envp);
+}
+
+static inline int waitpid(int pid, int *status, int options) {
+    return __syscall4(__NR_wait4, pid, status, options, 0);
+}
+
+static inline void _exit(int status) {
+    for (;;) { __syscall1(__NR_exit_group, status); }
+}
+
+
+/*
+    The vDSO is a tiny shared object the kernel maps into every process; its
+    address arrives in the auxiliary vector as AT_SYSINFO_EHDR. Walking its
+    dynamic symbol table once at startup gives a direct function pointer to
+    the kernel's user-space clock_gettime(), which reads the clock without a
+    mode switch. If the vDSO or symbol is missing we fall back to the syscall.
+*/
+#if defined(__x86_64__)
+#define VDSO_CLOCK_GETTIME "__vdso_clock_gettime"
+#else
+#define VDSO_CLOCK_GETTIME "__kernel_clock_gettime"
+#endif
+
+#ifndef CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC 1
+#endif
+
+static int (*vdso_clock_gettime)(int, struct timespec *);
+
+static int vdso_streq(const char *a, const char *b) {
+    while (*a && *a == *b) { a++; b++; }
+    return *a == *b;
+}
+
+static void vdso_init(unsigned long base) {
+    Elf64_Ehdr *eh = (Elf64_Ehdr *)base;
+    Elf64_Phdr *ph = (Elf64_Phdr *)(base + eh->e_phoff);
+    Elf64_Dyn *dyn = NULL;
+    Elf64_Sym *symtab = NULL;
+    const char *strtab = NULL;
+    unsigned int *hash = NULL;
+    unsigned long load = 0;
+    int i, have_load = 0;
+
+    for (i=0; i<eh->e_phnum; i++) {                                     // find load bias and dynamic section
+        if (ph[i].p_type == PT_LOAD && !have_load) {
+            load = base + ph[i].p_offset - ph[i].p_vaddr;
+            have_load = 1;
+        } else if (ph[i].p_type == PT_DYNAMIC) {
+            dyn = (Elf64_Dyn *)(base + ph[i].p_offset);
+        }
+    }
+    if (!have_load || !dyn) { return; }
+
+    for (; dyn->d_tag != DT_NULL; dyn++) {                              // locate symbol, string and hash tables
+        if (dyn->d_tag == DT_SYMTAB) { symtab = (Elf64_Sym *)(load + dyn->d_un.d_ptr); }
+        else if (dyn->d_tag == DT_STRTAB) { strtab = (const char *)(load + dyn->d_un.d_ptr); }
+        else if (dyn->d_tag == DT_HASH) { hash = (unsigned int *)(load + dyn->d_un.d_ptr); }
+    }
+    if (!symtab || !strtab || !hash) { return; }
+
+    for (i=0; i<(int)hash[1]; i++) {                                    // hash[1] is nchain == number of symbols
+        if (ELF64_ST_TYPE(symtab[i].st_info) != STT_FUNC || symtab[i].st_shndx == 0) { continue; }
+        if (vdso_streq(strtab + symtab[i].st_name, VDSO_CLOCK_GETTIME)) {
+            vdso_clock_gettime = (int (*)(int, struct timespec *))(load + symtab[i].st_value);
+            return;
+        }
+    }
+}
+
+static inline int clock_gettime(int clock_id, struct timespec *tp) {
+    if (vdso_clock_gettime) { return vdso_clock_gettime(clock_id, tp); }
+    return __syscall2(__NR_clock_gettime, clock_id, tp);
+}
+
+
+/*
+    The auxiliary vector the kernel passed to _start; getauxval() looks up
+    entries such as AT_HWCAP in it.
+*/
+static unsigned long *__auxv;
+
+static inline unsigned long getauxval(unsigned long type) {
+    unsigned long *a;
+    for (a = __auxv; a && a[0] != AT_NULL; a += 2) {
+        if (a[0] == type) { return a[1]; }
+    }
+    return 0;
+}
+
+
+/*
+    The compiler is allowed to emit calls to these for struct copies and
+    zero-initialisation even in freestanding mode.
+*/
+void *memset(void *dst, int c, size_t n) {
+    unsigned char *d = dst;
+    while (n--) { *d++ = (unsigned char)c; }
+    return dst;
+}
+
+void *memcpy(void *dst, const void *src, size_t n) {
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+    while (n--) { *d++ = *s++; }
+    return dst;
+}
+
+
+/*
+    Process entry point. The kernel starts us with the stack pointer at argc:
+
+        [ argc ] [ argv[0] .. argv[argc-1] ] [ NULL ] [ envp .. ] [ NULL ] [ auxv pairs .. ] [ AT_NULL ]
+
+    _start clears the frame pointer, aligns the stack to 16 bytes as the ABI
+    requires for a call, and hands the original stack pointer to __start_c.
+*/
+int main();
+
+__attribute__((used)) static void __start_c(long *sp) {
+    int argc = (int)sp[0];
+    char **argv = (char **)(sp + 1);
+    char **envp = argv + argc + 1;
+    unsigned long *auxv;
+    char **p = envp;
+
+    while (*p) { p++; }                                                 // skip environment to reach auxv
+    __auxv = (unsigned long *)(p + 1);
+    for (auxv = __auxv; auxv[0] != AT_NULL; auxv += 2) {
+        if (auxv[0] == AT_SYSINFO_EHDR) { vdso_init(auxv[1]); }
+    }
+
+    _exit(main(argc, argv, envp));
+}
+
+#if defined(__x86_64__)
+__asm__(".text\n"
+        ".global _start\n"
+        "_start:\n"
+        "    xor  %ebp, %ebp\n"
+        "    mov  %rsp, %rdi\n"
+        "    and  $-16, %rsp\n"
+        "    call __start_c\n"
+        "    hlt\n");
+#else
+__asm__(".text\n"
+        ".global _start\n"
+        "_start:\n"
+        "    mov  x29, #0\n"
+        "    mov  x30, #0\n"
+        "    mov  x0, sp\n"
+        "    and  sp, x0, #-16\n"
+        "    bl   __start_c\n"
+        "    brk  #0\n");
+#endif
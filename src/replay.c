@@ -0,0 +1,256 @@
+#include "library.c"
+#include "bench.h"
+
+/*
+    Trace replayer
+
+    Plays back a trace recorded by a program built with -DTRACE (see
+    trace_open() in library.c) against a headless buffer of the recorded
+    size, as fast as possible: sleeps are skipped and getkey() results are
+    only counted. Reports per-frame timings and a 64-bit FNV-1a hash of the
+    final framebuffer, so a captured workload can check an optimisation for
+    both speed and pixel-exact output.
+
+    Drawing the trace could not capture (bitmaps, sprites, PSF fonts,
+    FILL_BITMAP tiles, indexed mode; see trace_open()) is counted instead
+    of drawn (tiles are filled with their solid color). If there was any,
+    replay says so, marks the hash as not comparable and exits with
+    status 2.
+
+        gcc -O2 -DTRACE -o driver_trace driver.c && ./driver_trace   (writes graphics.trace)
+        gcc -O2 -o replay replay.c && ./replay graphics.trace [-v]
+
+    -v prints the time of every frame as well as the summary.
+*/
+
+#define REPLAY_MAX_COORDS (1 << 20)
+
+int coords[REPLAY_MAX_COORDS];              // decoded polyline / segment / polygon coordinates
+const unsigned char *in, *in_end;           // trace being decoded
+int bad;                                    // ran off the end or met an unknown record
+long untraced[5];                           // UNTRACED_* records seen, [0] for FILL_BITMAP fills
+const char *untraced_names[5] = { "tiled fill", "bitmap", "sprite", "indexed", "font" };
+
+
+/*
+    Next zigzag varint from the trace.
+*/
+long next_int() {
+    unsigned long z = 0;
+    int shift = 0;
+    while (in < in_end) {
+        z |= (unsigned long)(*in & 0x7F) << shift;
+        if (!(*in++ & 0x80)) { return (long)(z >> 1) ^ -(long)(z & 1); }
+        shift += 7;
+    }
+    bad = 1;
+    return 0;
+}
+
+
+/*
+    COUNT points of PER coordinates, undoing the delta encoding.
+    Returns 0 if they do not fit in coords[].
+*/
+int next_points(int count, int per) {
+    int i;
+    if (count < 0 || (long)count * per > REPLAY_MAX_COORDS) { bad = 1; return 0; }
+    for (i=0; i<count*per; i++) {
+        coords[i] = (int)next_int() + (i < per ? 0 : coords[i-per]);
+    }
+    return 1;
+}
+
+
+void next_fill(fill_t *f) {
+    int i;
+    f->style = next_int();
+    f->color = next_int();
+    f->background = next_int();
+    f->from = next_int();
+    f->to = next_int();
+    f->x0 = next_int();
+    f->y0 = next_int();
+    f->x1 = next_int();
+    f->y1 = next_int();
+    for (i=0; i<8; i++) { f->pattern[i] = (in < in_end) ? *in++ : 0; }
+    f->tile = NULL;
+    if (f->style == FILL_BITMAP) {              // the tile's pixels are not in the trace
+        f->style = FILL_SOLID;
+        untraced[0]++;
+    }
+}
+
+
+/*
+    64-bit FNV-1a over the visible buffer.
+*/
+unsigned long frame_hash() {
+    const unsigned char *p = (const unsigned char *)display_addr;
+    unsigned long h = 14695981039346656037UL;
+    size_t i;
+    for (i=0; i<screen_size; i++) {
+        h ^= p[i];
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+
+void print_hex(unsigned long n) {
+    char buf[16];
+    int i;
+    for (i=15; i>=0; i--, n >>= 4) { buf[i] = "0123456789abcdef"[n & 0xF]; }
+    write(1, buf, 16);
+}
+
+
+int main(int argc, char **argv) {
+    int fd, op, x, y, w, h, c, n, verbose;
+    long size, keys = 0, calls = 0, frames = 0, skipped = 0;
+    unsigned long frame_start, t, total = 0, best = ~0UL, worst = 0;
+    char *text = NULL;
+    size_t text_size = 0;
+    fill_t fill;
+
+    if (argc < 2) {
+        print_str("usage: replay TRACE [-v]\n");
+        return 1;
+    }
+    verbose = (argc > 2 && argv[2][0] == '-' && argv[2][1] == 'v');
+
+    fd = open(argv[1], O_RDONLY);
+    size = (fd < 0) ? -1 : lseek(fd, 0, SEEK_END);
+    if (size < 5) {
+        print_str("replay: cannot read trace\n");
+        return 1;
+    }
+    in = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    in_end = in + size;
+    if (in[0] != 'G' || in[1] != 'L' || in[2] != 'T' || in[3] != 'R' || in[4] < 1 || in[4] > TRACE_VERSION) {
+        print_str("replay: not a version 1 or 2 trace\n");
+        return 1;
+    }
+    in += 5;
+
+    frame_start = now_ns();
+    while (in < in_end && !bad) {
+        op = *in++;
+        calls++;
+        switch (op) {
+        case TRACE_INIT:
+            w = next_int();
+            h = next_int();
+            init_headless(w, h);
+            break;
+        case TRACE_PIXEL:
+            x = next_int(); y = next_int();
+            draw_pixel(x, y, next_int());
+            break;
+        case TRACE_LINE:
+            x = next_int(); y = next_int(); w = next_int(); h = next_int();
+            draw_line(x, y, w, h, next_int());
+            break;
+        case TRACE_CHAR:
+            x = next_int(); y = next_int(); c = next_int();
+            draw_char(x, y, c, next_int());
+            break;
+        case TRACE_TEXT:
+            x = next_int(); y = next_int(); c = next_int(); n = next_int();
+            if (n < 0 || n > in_end - in) { bad = 1; break; }
+            if ((size_t)n + 1 > text_size) {                    // grow the buffer to fit the record
+                if (text) { munmap(text, text_size); }
+                text_size = ((size_t)n + 4096) & ~(size_t)4095;
+                text = mmap(0, text_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (text == MAP_FAILED) { text = NULL; text_size = 0; bad = 1; break; }
+            }
+            for (w=0; w<n; w++) { text[w] = *in++; }
+            text[n] = '\0';
+            draw_text(x, y, text, c);
+            break;
+        case TRACE_POLYLINE:
+        case TRACE_LINES:
+            n = next_int();
+            c = next_int();
+            if (!next_points(n, op == TRACE_LINES ? 4 : 2)) { break; }
+            if (op == TRACE_LINES) { draw_lines(coords, n, c); } else { draw_polyline(coords, n, c); }
+            break;
+        case TRACE_FILL_RECT:
+            x = next_int(); y = next_int(); w = next_int(); h = next_int();
+            next_fill(&fill);
+            fill_rect(x, y, w, h, &fill);
+            break;
+        case TRACE_FILL_CIRCLE:
+            x = next_int(); y = next_int(); w = next_int();
+            next_fill(&fill);
+            fill_circle(x, y, w, &fill);
+            break;
+        case TRACE_FILL_POLYGON:
+            n = next_int();
+            next_int();                                         // unused color slot
+            if (!next_points(n, 2)) { break; }
+            next_fill(&fill);
+            fill_polygon(coords, n, &fill);
+            break;
+        case TRACE_KEY:
+            if (next_int()) { keys++; }
+            break;
+        case TRACE_UNTRACED:
+            n = next_int();
+            if (n < 1 || n > 4) { bad = 1; break; }
+            untraced[n]++;
+            break;
+        case TRACE_FRAME:
+            next_int();
+            t = now_ns() - frame_start;
+            total += t;
+            if (t < best) { best = t; }
+            if (t > worst) { worst = t; }
+            if (verbose) {
+                print_str("frame ");
+                print_num(frames);
+                print_str(": ");
+                print_num(t / 1000);
+                print_str("us\n");
+            }
+            frames++;
+            frame_start = now_ns();
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+        if (!display_addr && op != TRACE_INIT) { bad = 1; }      // drawing before TRACE_INIT
+    }
+
+    if (bad) {
+        print_str("replay: trace is truncated or corrupt\n");
+        return 1;
+    }
+
+    print_str("calls ");      print_num(calls);
+    print_str("  keys ");     print_num(keys);
+    print_str("  frames ");   print_num(frames);
+    print_str("\ntotal ");    print_num(total / 1000);
+    print_str("us  mean ");   print_num(frames ? total / frames / 1000 : 0);
+    print_str("us  best ");   print_num(frames ? best / 1000 : 0);
+    print_str("us  worst ");  print_num(worst / 1000);
+    print_str("us\nhash ");   print_hex(frame_hash());
+
+    for (n=0; n<5; n++) { skipped += untraced[n]; }
+    if (skipped) {
+        print_str("  NOT COMPARABLE: trace has untraced drawing (");
+        for (n=0, w=0; n<5; n++) {
+            if (!untraced[n]) { continue; }
+            if (w++) { print_str(", "); }
+            print_num(untraced[n]);
+            print_str(" ");
+            print_str(untraced_names[n]);
+        }
+        print_str(")\n");
+        return 2;
+    }
+    print_str("\n");
+
+    return 0;
+}